@@ -0,0 +1,147 @@
+#include "GenerateFFIBindings.hpp"
+#include "clang/Basic/TargetInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace {
+/** Adds a length-prefixed string to the hash, so that consecutive inputs
+ * can't run into each other. */
+void hashString(llvm::MD5 &Hash, llvm::StringRef Str) {
+  Hash.update(std::to_string(Str.size()) + ":");
+  Hash.update(Str);
+}
+}
+
+bool BindingCache::computeKey(ASTContext &Context,
+                              const std::string &Predefines,
+                              const std::vector<std::string> &Options,
+                              const std::vector<std::string> &InputFiles) {
+
+  llvm::MD5 Hash;
+  hashString(Hash, constants::CACHE_FORMAT_VERSION);
+  hashString(Hash, Context.getTargetInfo().getTriple().str());
+  hashString(Hash, Predefines);
+
+  for (const std::string &Option : Options)
+    hashString(Hash, Option);
+
+  for (const std::string &InputFile : InputFiles) {
+    if (InputFile == "")
+      continue;
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(InputFile);
+    if (!Buffer)
+      return false;
+    hashString(Hash, InputFile);
+    hashString(Hash, (*Buffer)->getBuffer());
+  }
+
+  // the source manager holds every file that was read while parsing this
+  // translation unit; it is keyed by pointers, so the files are sorted by
+  // name to get the same key in every run
+  SourceManager &SM = Context.getSourceManager();
+  std::vector<std::pair<std::string, const SrcMgr::ContentCache *>> Files;
+  for (SourceManager::fileinfo_iterator I = SM.fileinfo_begin(),
+                                        E = SM.fileinfo_end();
+       I != E; ++I)
+    Files.push_back(std::make_pair(I->first->getName(), I->second));
+  std::sort(Files.begin(), Files.end(),
+            [](const std::pair<std::string, const SrcMgr::ContentCache *> &A,
+               const std::pair<std::string, const SrcMgr::ContentCache *> &B) {
+              return A.first < B.first;
+            });
+
+  for (std::vector<std::pair<std::string,
+                             const SrcMgr::ContentCache *>>::iterator I =
+           Files.begin();
+       I != Files.end(); ++I) {
+    hashString(Hash, I->first);
+    const llvm::MemoryBuffer *Buffer = I->second->getRawBuffer();
+    if (!Buffer)
+      return false;
+    hashString(Hash, Buffer->getBuffer());
+  }
+
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  llvm::SmallString<32> ResultString;
+  llvm::MD5::stringifyResult(Result, ResultString);
+  key = ResultString.str();
+  return true;
+}
+
+bool BindingCache::restore(const std::string &outputFileName,
+                           std::vector<std::string> &Dependencies) {
+
+  if (key == "" || !llvm::sys::fs::exists(getCacheFileName()))
+    return false;
+
+  // the list of dependencies is stored before the output, so an entry with
+  // an output always has it
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(getDependencyFileName());
+  if (!Buffer)
+    return false;
+  llvm::SmallVector<llvm::StringRef, 16> Lines;
+  (*Buffer)->getBuffer().split(Lines, "\n", -1, false);
+  Dependencies.assign(Lines.begin(), Lines.end());
+
+  return copyFile(getCacheFileName(), outputFileName);
+}
+
+void BindingCache::store(const std::string &outputFileName,
+                         const std::vector<std::string> &Dependencies) {
+
+  if (key == "")
+    return;
+
+  llvm::sys::fs::create_directories(cacheDirectory);
+
+  std::error_code Err;
+  OutputSink Output(getDependencyFileName());
+  if (!Output.open(Err))
+    return;
+  for (const std::string &Dependency : Dependencies)
+    Output.stream() << Dependency << "\n";
+  if (!Output.commit(Err))
+    return;
+
+  copyFile(outputFileName, getCacheFileName());
+}
+
+bool BindingCache::restoreFile(const std::string &suffix,
+                               const std::string &fileName) {
+
+  if (key == "" || !llvm::sys::fs::exists(cacheDirectory + key + suffix))
+    return false;
+
+  return copyFile(cacheDirectory + key + suffix, fileName);
+}
+
+void BindingCache::storeFile(const std::string &suffix,
+                             const std::string &fileName) {
+
+  if (key == "")
+    return;
+
+  llvm::sys::fs::create_directories(cacheDirectory);
+  copyFile(fileName, cacheDirectory + key + suffix);
+}
+
+bool BindingCache::copyFile(const std::string &From, const std::string &To) {
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(From);
+  if (!Buffer)
+    return false;
+
+  std::error_code Err;
+  // entries are written atomically as well, so that concurrent compilations
+  // sharing the cache never see a partially written entry
+  OutputSink Output(To);
+  if (!Output.open(Err))
+    return false;
+  Output.stream() << (*Buffer)->getBuffer();
+  return Output.commit(Err);
+}
@@ -0,0 +1,135 @@
+#include "GenerateFFIBindings.hpp"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace {
+/** Converts a glob pattern ("*", "?" and "[...]") to a regular expression. */
+std::string globToRegex(StringRef Glob) {
+
+  std::string Regex;
+  for (size_t i = 0; i < Glob.size(); i++) {
+    char c = Glob[i];
+    if (c == '*')
+      Regex += ".*";
+    else if (c == '?')
+      Regex += '.';
+    else if (c == '[' && Glob.find(']', i + 1) != StringRef::npos) {
+      size_t End = Glob.find(']', i + 1);
+      StringRef Class = Glob.slice(i + 1, End);
+      Regex += '[';
+      if (Class.startswith("!")) {
+        Regex += '^';
+        Class = Class.drop_front();
+      }
+      Regex += Class;
+      Regex += ']';
+      i = End;
+    } else
+      Regex += llvm::Regex::escape(StringRef(&c, 1));
+  }
+  return Regex;
+}
+}
+
+bool DeclarationFilter::load(const std::string &FileName, std::string &Error) {
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    Error = "Error opening file: \"" + FileName + "\"";
+    return false;
+  }
+
+  // all patterns of the same action and kind are joined into one regular
+  // expression, so that each is matched only once per declaration
+  std::string Patterns[NUM_ACTIONS][NUM_KINDS];
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, "\n", -1, false);
+  for (unsigned LineNumber = 0; LineNumber < Lines.size(); LineNumber++) {
+    StringRef Line = Lines[LineNumber].trim();
+    if (Line.empty() || Line.startswith("#"))
+      continue;
+
+    std::pair<StringRef, StringRef> ActionSplit = Line.split(' ');
+    std::pair<StringRef, StringRef> KindSplit =
+        ActionSplit.second.trim().split(' ');
+    StringRef Pattern = KindSplit.second.trim();
+
+    Action A = NUM_ACTIONS;
+    if (ActionSplit.first == "include")
+      A = INCLUDE;
+    else if (ActionSplit.first == "exclude")
+      A = EXCLUDE;
+    Kind K = NUM_KINDS;
+    if (KindSplit.first == "name")
+      K = DECL_NAME;
+    else if (KindSplit.first == "namespace")
+      K = NAMESPACE_NAME;
+    else if (KindSplit.first == "file")
+      K = FILE_NAME;
+
+    if (A == NUM_ACTIONS || K == NUM_KINDS || Pattern.empty()) {
+      Error = FileName + ":" + std::to_string(LineNumber + 1) +
+              ": expected \"include|exclude name|namespace|file <pattern>\"";
+      return false;
+    }
+
+    // a pattern between slashes is a regular expression, anything else is
+    // a glob
+    std::string Regex;
+    if (Pattern.size() > 1 && Pattern.startswith("/") && Pattern.endswith("/"))
+      Regex = Pattern.slice(1, Pattern.size() - 1);
+    else
+      Regex = globToRegex(Pattern);
+
+    if (!Patterns[A][K].empty())
+      Patterns[A][K] += "|";
+    Patterns[A][K] += "^(" + Regex + ")$";
+  }
+
+  for (unsigned A = 0; A < NUM_ACTIONS; A++) {
+    for (unsigned K = 0; K < NUM_KINDS; K++) {
+      if (Patterns[A][K].empty())
+        continue;
+      Matchers[A][K].reset(new llvm::Regex(Patterns[A][K]));
+      std::string RegexError;
+      if (!Matchers[A][K]->isValid(RegexError)) {
+        Error = FileName + ": invalid pattern: " + RegexError;
+        return false;
+      }
+      isEmpty = false;
+    }
+  }
+  return true;
+}
+
+bool DeclarationFilter::isExcluded(StringRef Name, StringRef Namespace,
+                                   const FileEntry *File) {
+
+  bool Matched[NUM_ACTIONS] = {false, false};
+  for (unsigned A = 0; A < NUM_ACTIONS; A++) {
+    if (Matchers[A][DECL_NAME] && Matchers[A][DECL_NAME]->match(Name))
+      Matched[A] = true;
+    if (Namespace != "" && Matchers[A][NAMESPACE_NAME] &&
+        Matchers[A][NAMESPACE_NAME]->match(Namespace))
+      Matched[A] = true;
+  }
+
+  // every declaration of a header is matched against the same file
+  // patterns, so the result is computed once per file
+  if (File) {
+    llvm::DenseMap<const FileEntry *, std::pair<bool, bool>>::iterator it =
+        FileMatches.find(File);
+    if (it == FileMatches.end()) {
+      std::pair<bool, bool> Match(false, false);
+      if (Matchers[INCLUDE][FILE_NAME])
+        Match.first = Matchers[INCLUDE][FILE_NAME]->match(File->getName());
+      if (Matchers[EXCLUDE][FILE_NAME])
+        Match.second = Matchers[EXCLUDE][FILE_NAME]->match(File->getName());
+      it = FileMatches.insert(std::make_pair(File, Match)).first;
+    }
+    Matched[INCLUDE] |= it->second.first;
+    Matched[EXCLUDE] |= it->second.second;
+  }
+
+  return Matched[EXCLUDE] && !Matched[INCLUDE];
+}
@@ -0,0 +1,255 @@
+#include "GenerateFFIBindings.hpp"
+
+void DeclarationOrderer::emitDeclarations(llvm::raw_ostream &output_) {
+
+  output = &output_;
+  llvm::MapVector<unsigned, DeclarationInfo> *UnresolvedDeclarations =
+      utils->getUnresolvedDeclarations();
+
+  // number the declarations that are still waiting to be printed
+  llvm::DenseMap<unsigned, unsigned> NodeIndex;
+  for (llvm::MapVector<unsigned, DeclarationInfo>::iterator it =
+           UnresolvedDeclarations->begin();
+       it != UnresolvedDeclarations->end(); ++it) {
+    if (it->second.isResolved)
+      continue;
+    NodeIndex[it->first] = Nodes.size();
+    Nodes.push_back(it->first);
+    NodeInfo.push_back(&it->second);
+  }
+
+  unsigned NumNodes = Nodes.size();
+  Dependents.resize(NumNodes);
+  InDegree.resize(NumNodes, 0);
+  Emitted.resize(NumNodes, false);
+  ForwardDeclared.resize(NumNodes, false);
+  Dropped.resize(NumNodes, false);
+
+  // build the dependency graph; an edge goes from a dependency to the
+  // declaration that depends on it
+  std::vector<std::pair<unsigned, unsigned>> Unresolvable;
+  for (unsigned Node = 0; Node < NumNodes; Node++) {
+    ArrayRef<unsigned> dependencyList = NodeInfo[Node]->dependencyList;
+    for (ArrayRef<unsigned>::iterator dependency = dependencyList.begin();
+         dependency != dependencyList.end(); ++dependency) {
+      if (utils->isInResolvedDecls(*dependency))
+        continue;
+      llvm::DenseMap<unsigned, unsigned>::iterator Dep =
+          NodeIndex.find(*dependency);
+      if (Dep == NodeIndex.end()) {
+        // this dependency was never found, so it will never be printed
+        Unresolvable.push_back(std::make_pair(Node, *dependency));
+        continue;
+      }
+      Dependents[Dep->second].push_back(Node);
+      InDegree[Node]++;
+    }
+  }
+
+  NumPending = NumNodes;
+  for (std::vector<std::pair<unsigned, unsigned>>::iterator it =
+           Unresolvable.begin();
+       it != Unresolvable.end(); ++it)
+    drop(it->first, it->second);
+
+  for (unsigned Node = 0; Node < NumNodes; Node++) {
+    if (!Dropped[Node] && InDegree[Node] == 0)
+      Ready.push(Node);
+  }
+  emitReady();
+  if (NumPending == 0)
+    return;
+
+  // whatever is left is blocked by dependency cycles. The strongly connected
+  // components are only found once: Tarjan's algorithm completes every
+  // component after the components that depend on it, so going through them
+  // backwards, the dependencies of each one have been printed (or dropped)
+  // by the time it is broken
+  std::vector<unsigned> SCC;
+  unsigned NumSCCs = findSCCs(SCC);
+  std::vector<std::vector<unsigned>> Components(NumSCCs);
+  for (unsigned Node = 0; Node < NumNodes; Node++) {
+    if (isPending(Node))
+      Components[SCC[Node]].push_back(Node);
+  }
+  for (unsigned Component = NumSCCs; Component-- > 0 && NumPending > 0;)
+    breakCycles(Components[Component]);
+}
+
+void DeclarationOrderer::emitReady() {
+
+  while (!Ready.empty()) {
+    unsigned Node = Ready.top();
+    Ready.pop();
+    if (isPending(Node))
+      emit(Node);
+  }
+}
+
+void DeclarationOrderer::emit(unsigned Node) {
+
+  DeclarationInfo *DeclInfo = NodeInfo[Node];
+  DeclInfo->isResolved = true;
+  utils->addToResolvedDecls(Nodes[Node]);
+  // print out the declaration
+  utils->writeDeclaration(*output, Nodes[Node], DeclInfo->Declaration,
+                          DeclInfo->dependencyList);
+  Emitted[Node] = true;
+  NumPending--;
+
+  // dependents of a forward declared record were released when the forward
+  // declaration was printed
+  if (!ForwardDeclared[Node])
+    release(Node);
+}
+
+void DeclarationOrderer::forwardDeclare(unsigned Node) {
+
+  utils->addToResolvedDecls(Nodes[Node]);
+  // print out the forward declaration
+  utils->writeForwardDeclaration(*output, Nodes[Node]);
+  ForwardDeclared[Node] = true;
+  utils->getStats()->increment(FFIBindingsStats::FORWARD_DECLARED);
+  release(Node);
+}
+
+void DeclarationOrderer::release(unsigned Node) {
+
+  for (std::vector<unsigned>::iterator Dependent = Dependents[Node].begin();
+       Dependent != Dependents[Node].end(); ++Dependent) {
+    if (--InDegree[*Dependent] == 0)
+      Ready.push(*Dependent);
+  }
+}
+
+void DeclarationOrderer::drop(unsigned Node, unsigned Reason) {
+
+  if (Dropped[Node])
+    return;
+
+  unsigned DiagID = DE.getCustomDiagID(
+      DiagnosticsEngine::Warning, "ffi-gen: '%0' will not be emitted because "
+                                  "it depends on '%1', which cannot be "
+                                  "resolved");
+
+  std::stack<std::pair<unsigned, unsigned>> ToDrop;
+  ToDrop.push(std::make_pair(Node, Reason));
+  Dropped[Node] = true;
+  NumPending--;
+
+  while (ToDrop.size()) {
+    std::pair<unsigned, unsigned> Current = ToDrop.top();
+    ToDrop.pop();
+    utils->getStats()->increment(FFIBindingsStats::DROPPED);
+    DE.Report(DiagID) << utils->getDeclName(Nodes[Current.first])
+                      << utils->getDeclName(Current.second);
+
+    for (std::vector<unsigned>::iterator Dependent =
+             Dependents[Current.first].begin();
+         Dependent != Dependents[Current.first].end(); ++Dependent) {
+      if (!Dropped[*Dependent] && !Emitted[*Dependent]) {
+        Dropped[*Dependent] = true;
+        NumPending--;
+        ToDrop.push(std::make_pair(*Dependent, Nodes[Current.first]));
+      }
+    }
+  }
+}
+
+void DeclarationOrderer::breakCycles(ArrayRef<unsigned> Component) {
+
+  // a component can contain more than one cycle, so its records are forward
+  // declared one at a time (only records can be), until it is printed
+  unsigned FirstPending = 0;
+  unsigned NextRecord = 0;
+  while (true) {
+    while (FirstPending < Component.size() &&
+           !isPending(Component[FirstPending]))
+      FirstPending++;
+    if (FirstPending == Component.size())
+      return;
+
+    while (NextRecord < Component.size() &&
+           (!isPending(Component[NextRecord]) ||
+            !isa<RecordDecl>(utils->getDecl(Nodes[Component[NextRecord]]))))
+      NextRecord++;
+    if (NextRecord == Component.size())
+      break;
+    forwardDeclare(Component[NextRecord++]);
+    emitReady();
+  }
+
+  // a cycle without records can't be broken, so its declarations (and
+  // everything that depends on them) are skipped
+  for (unsigned i = FirstPending; i < Component.size(); i++) {
+    if (isPending(Component[i]))
+      drop(Component[i], Nodes[Component[i]]);
+  }
+}
+
+unsigned DeclarationOrderer::findSCCs(std::vector<unsigned> &SCC) {
+
+  const unsigned Unvisited = ~0U;
+  unsigned NumNodes = Nodes.size();
+  std::vector<unsigned> Index(NumNodes, Unvisited);
+  std::vector<unsigned> LowLink(NumNodes, 0);
+  std::vector<bool> OnStack(NumNodes, false);
+  std::vector<unsigned> Stack;
+  // iterative version of Tarjan's algorithm, so that long dependency chains
+  // don't overflow the call stack; each entry holds a node and the index of
+  // the next edge to visit
+  std::vector<std::pair<unsigned, unsigned>> CallStack;
+  unsigned NextIndex = 0;
+  unsigned NumSCCs = 0;
+
+  SCC.assign(NumNodes, Unvisited);
+
+  for (unsigned Root = 0; Root < NumNodes; Root++) {
+    if (!isPending(Root) || Index[Root] != Unvisited)
+      continue;
+
+    Index[Root] = LowLink[Root] = NextIndex++;
+    Stack.push_back(Root);
+    OnStack[Root] = true;
+    CallStack.push_back(std::make_pair(Root, 0));
+
+    while (CallStack.size()) {
+      unsigned Node = CallStack.back().first;
+      unsigned Edge = CallStack.back().second;
+      unsigned NumEdges = Dependents[Node].size();
+
+      if (Edge < NumEdges) {
+        CallStack.back().second++;
+        unsigned Next = Dependents[Node][Edge];
+        if (!isPending(Next))
+          continue;
+        if (Index[Next] == Unvisited) {
+          Index[Next] = LowLink[Next] = NextIndex++;
+          Stack.push_back(Next);
+          OnStack[Next] = true;
+          CallStack.push_back(std::make_pair(Next, 0));
+        } else if (OnStack[Next])
+          LowLink[Node] = std::min(LowLink[Node], Index[Next]);
+        continue;
+      }
+
+      CallStack.pop_back();
+      if (CallStack.size()) {
+        unsigned Parent = CallStack.back().first;
+        LowLink[Parent] = std::min(LowLink[Parent], LowLink[Node]);
+      }
+
+      if (LowLink[Node] == Index[Node]) {
+        unsigned Member;
+        do {
+          Member = Stack.back();
+          Stack.pop_back();
+          OnStack[Member] = false;
+          SCC[Member] = NumSCCs;
+        } while (Member != Node);
+        NumSCCs++;
+      }
+    }
+  }
+  return NumSCCs;
+}
@@ -1,22 +1,21 @@
 #include "GenerateFFIBindings.hpp"
 
 bool EnumVisitor::VisitEnumDecl(EnumDecl *ED) {
-  if (!ED->hasAttr<FFIBindingAttr>())
+  if (!utils->isMarked(ED))
     return true;
 
-  if (FFIBindingsUtils::getInstance()->isInResolvedDecls("enum " +
-                                                         ED->getNameAsString()))
+  unsigned EnumID = utils->getDeclID(ED);
+
+  if (utils->isInResolvedDecls(EnumID))
     return true;
 
-  if (FFIBindingsUtils::getInstance()->isOnBlacklist("enum " +
-                                                     ED->getNameAsString())) {
-    FFIBindingsUtils::getInstance()->getResolvedDecls()->insert(
-        "enum " + ED->getNameAsString());
+  if (utils->isOnBlacklist(EnumID)) {
+    utils->addToResolvedDecls(EnumID);
     return true;
   }
 
-  FFIBindingsUtils::getInstance()->setHasMarkedDeclarations(true);
-  FFIBindingsUtils::getInstance()->resolveEnumDecl(ED);
+  utils->setHasMarkedDeclarations(true);
+  utils->resolveEnumDecl(ED);
 
   return true;
 }
@@ -0,0 +1,87 @@
+#include "GenerateFFIBindings.hpp"
+#include "llvm/Support/Format.h"
+
+static const char *const PhaseNames[] = {
+    "collect", "resolve", "find", "emit", "write", "check_type"};
+
+static const char *const PhaseDescriptions[] = {
+    "Collecting marked declarations", "Resolving marked declarations",
+    "Resolving dependencies", "Ordering and printing declarations",
+    "Writing output", "checkType() (part of resolving)"};
+
+static const char *const CounterNames[] = {
+    "decls_visited",
+    "decls_marked",
+    "resolved_directly",
+    "deferred",
+    "forward_declared",
+    "dropped",
+    "check_type_calls",
+    "check_type_memo_hits",
+    "bytes_emitted",
+    "decl_ids",
+    "peak_decls_to_find",
+    "peak_unresolved_decls"};
+
+void writeJSONString(llvm::raw_ostream &OS, StringRef S) {
+
+  for (unsigned char C : S) {
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C < 0x20)
+      OS << llvm::format("\\u%04x", C);
+    else
+      OS << C;
+  }
+}
+
+void FFIBindingsStats::startPhase(Phase P) {
+
+  if (Depth[P]++ == 0)
+    Started[P] = llvm::TimeRecord::getCurrentTime(true);
+}
+
+void FFIBindingsStats::stopPhase(Phase P) {
+
+  if (--Depth[P] != 0)
+    return;
+  llvm::TimeRecord Elapsed = llvm::TimeRecord::getCurrentTime(false);
+  Elapsed -= Started[P];
+  Times[P] += Elapsed;
+}
+
+void FFIBindingsStats::printTimeReport(llvm::raw_ostream &OS) {
+
+  OS << "===---------------------------------------------------------===\n";
+  OS << "                    ffi-gen time report\n";
+  OS << "===---------------------------------------------------------===\n";
+  OS << "   ---User Time---   --System Time--   ---Wall Time---  --- Name ---\n";
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    OS << llvm::format("   %7.4f seconds   %7.4f seconds   %7.4f seconds  ",
+                       Times[i].getUserTime(), Times[i].getSystemTime(),
+                       Times[i].getWallTime());
+    OS << PhaseDescriptions[i] << "\n";
+  }
+  OS << "\n";
+}
+
+void FFIBindingsStats::printJSON(llvm::raw_ostream &OS,
+                                 StringRef SourceFileName) {
+
+  OS << "{\n  \"file\": \"";
+  writeJSONString(OS, SourceFileName);
+  OS << "\",\n  \"phases\": {\n";
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    OS << "    \"" << PhaseNames[i] << "\": {";
+    OS << llvm::format("\"wall\": %f, \"user\": %f, \"system\": %f",
+                       Times[i].getWallTime(), Times[i].getUserTime(),
+                       Times[i].getSystemTime());
+    OS << "}" << (i + 1 < NUM_PHASES ? "," : "") << "\n";
+  }
+  OS << "  },\n  \"counters\": {\n";
+  for (unsigned i = 0; i < NUM_COUNTERS; i++) {
+    OS << "    \"" << CounterNames[i] << "\": " << Counters[i];
+    OS << (i + 1 < NUM_COUNTERS ? "," : "") << "\n";
+  }
+  OS << "  }\n}\n";
+}
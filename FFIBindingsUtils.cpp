@@ -1,48 +1,176 @@
 #include "GenerateFFIBindings.hpp"
+#include "clang/Basic/CharInfo.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+
+unsigned FFIBindingsUtils::getDeclID(Decl *D) {
+
+  D = D->getCanonicalDecl();
+  llvm::DenseMap<Decl *, unsigned>::iterator it = DeclIDs.find(D);
+  if (it != DeclIDs.end())
+    return it->second;
+
+  unsigned ID = Decls.size();
+  Decls.push_back(D);
+  DeclIDs[D] = ID;
+  ResolvedDecls.resize(ID + 1);
+  BlacklistedDecls.resize(ID + 1);
+
+  // the blacklist contains type spellings, so this is the only place where
+  // a declaration has to be printed before it is emitted
+  if (!blacklist->empty() || !Filter.empty()) {
+    std::string BlacklistName;
+    if (TypedefNameDecl *TD = dyn_cast<TypedefNameDecl>(D))
+      BlacklistName = TD->getNameAsString();
+    else if (TypeDecl *TD = dyn_cast<TypeDecl>(D))
+      BlacklistName =
+          TD->getTypeForDecl()->getCanonicalTypeInternal().getAsString();
+    else if (NamedDecl *ND = dyn_cast<NamedDecl>(D))
+      BlacklistName = ND->getQualifiedNameAsString();
+    if (blacklist->find(BlacklistName) != blacklist->end())
+      BlacklistedDecls.set(ID);
+    else if (!Filter.empty() && isExcludedByFilter(D, BlacklistName))
+      BlacklistedDecls.set(ID);
+  }
+
+  return ID;
+}
+
+bool FFIBindingsUtils::isMarked(Decl *D) {
+
+  if (D->hasAttr<FFIBindingAttr>())
+    return true;
+  if (!options.isExportAllMode || D->isImplicit())
+    return false;
+  return isInExportedFile(D);
+}
+
+bool FFIBindingsUtils::isInExportedFile(Decl *D) {
+
+  // every declaration of a file gives the same answer, so it is computed
+  // once per file
+  SourceManager &SM = D->getASTContext().getSourceManager();
+  SourceLocation Loc = SM.getSpellingLoc(D->getLocation());
+  if (Loc.isInvalid())
+    return false;
+  FileID FID = SM.getFileID(Loc);
+  llvm::DenseMap<FileID, bool>::iterator it = ExportedFiles.find(FID);
+  if (it != ExportedFiles.end())
+    return it->second;
+
+  bool isExported = FID == SM.getMainFileID();
+  const FileEntry *File = SM.getFileEntryForID(FID);
+  if (!isExported && File) {
+    // the file manager gives the same entry to every path of a file
+    for (const std::string &Header : options.exportHeaders) {
+      if (SM.getFileManager().getFile(Header) == File) {
+        isExported = true;
+        break;
+      }
+    }
+  }
+  ExportedFiles[FID] = isExported;
+  return isExported;
+}
+
+bool FFIBindingsUtils::isExcludedByFilter(Decl *D, const std::string &Name) {
+
+  std::string Namespace;
+  for (DeclContext *DC = D->getDeclContext(); DC; DC = DC->getParent()) {
+    if (NamespaceDecl *ND = dyn_cast<NamespaceDecl>(DC)) {
+      Namespace = ND->getQualifiedNameAsString();
+      break;
+    }
+  }
+
+  SourceManager &SM = D->getASTContext().getSourceManager();
+  const FileEntry *File =
+      SM.getFileEntryForID(SM.getFileID(SM.getExpansionLoc(D->getLocation())));
 
-FFIBindingsUtils *FFIBindingsUtils::instance = NULL;
+  return Filter.isExcluded(Name, Namespace, File);
+}
 
-FFIBindingsUtils *FFIBindingsUtils::getInstance() {
+std::string FFIBindingsUtils::getDeclName(unsigned ID) {
 
-  if (!instance)
-    instance = new FFIBindingsUtils();
+  Decl *D = Decls[ID];
 
-  return instance;
+  if (RecordDecl *RD = dyn_cast<RecordDecl>(D)) {
+    if (RD->getNameAsString() == "")
+      return (RD->isUnion() ? "union " : "struct ") + getAnonRecordName(RD);
+  }
+  if (TypedefNameDecl *TD = dyn_cast<TypedefNameDecl>(D))
+    return TD->getNameAsString();
+  if (TypeDecl *TD = dyn_cast<TypeDecl>(D))
+    return TD->getTypeForDecl()->getCanonicalTypeInternal().getAsString();
+  if (NamedDecl *ND = dyn_cast<NamedDecl>(D))
+    return ND->getQualifiedNameAsString();
+
+  return "";
 }
 
-bool FFIBindingsUtils::isNewType(QualType Type) {
+bool FFIBindingsUtils::isNewType(unsigned ID) {
 
-  if (isInResolvedDecls(Type.getAsString()))
+  if (isInResolvedDecls(ID))
     return false;
 
-  if (isInUnresolvedDeclarations(Type.getAsString()))
+  if (isInUnresolvedDeclarations(ID))
     return false;
 
   return true;
 }
 
-bool FFIBindingsUtils::isInUnresolvedDeclarations(std::string DeclType) {
+bool FFIBindingsUtils::isInUnresolvedDeclarations(unsigned ID) {
 
-  if (UnresolvedDeclarations->find(DeclType) != UnresolvedDeclarations->end())
+  if (UnresolvedDeclarations->count(ID))
     return true;
 
   return false;
 }
 
-bool FFIBindingsUtils::isInResolvedDecls(std::string DeclType) {
+bool FFIBindingsUtils::isInResolvedDecls(unsigned ID) {
 
-  if (ResolvedDecls->find(DeclType) != ResolvedDecls->end())
-    return true;
+  return ResolvedDecls.test(ID);
+}
 
-  return false;
+bool FFIBindingsUtils::isOnBlacklist(unsigned ID) {
+
+  return BlacklistedDecls.test(ID);
 }
 
-bool FFIBindingsUtils::isOnBlacklist(std::string DeclType) {
+void FFIBindingsUtils::addToResolvedDecls(unsigned ID) { ResolvedDecls.set(ID); }
+
+std::string FFIBindingsUtils::getAnonRecordName(RecordDecl *RD) {
+
+  RD = RD->getCanonicalDecl();
+  llvm::DenseMap<RecordDecl *, std::string>::iterator it =
+      AnonRecordNames.find(RD);
+  if (it != AnonRecordNames.end())
+    return it->second;
+
+  // the name is formed from the name of the file and the offset of the record
+  // in it, so it is the same on every machine and doesn't depend on the order
+  // in which records are found
+  SourceManager &SM = Context->getSourceManager();
+  std::pair<FileID, unsigned> Location =
+      SM.getDecomposedExpansionLoc(RD->getLocation());
+  std::string FileName = "";
+  if (const FileEntry *FE = SM.getFileEntryForID(Location.first))
+    FileName = llvm::sys::path::filename(FE->getName());
+  for (char &c : FileName) {
+    if (!isAlphanumeric(c))
+      c = '_';
+  }
 
-  if (blacklist->find(DeclType) != blacklist->end())
-    return true;
+  std::string Name =
+      "Anonymous_" + FileName + "_" + std::to_string(Location.second);
+  // records from files with the same name (or from the same macro
+  // expansion) can end up with the same name
+  std::string UniqueName = Name;
+  for (unsigned i = 1; !UsedAnonRecordNames.insert(UniqueName).second; i++)
+    UniqueName = Name + "_" + std::to_string(i);
 
-  return false;
+  AnonRecordNames[RD] = UniqueName;
+  return UniqueName;
 }
 
 std::string FFIBindingsUtils::getArraySize(const ConstantArrayType *CAT) {
@@ -109,85 +237,345 @@ std::string FFIBindingsUtils::getDeclAttrs(Decl *D) {
   return attrList;
 }
 
-void FFIBindingsUtils::resolveAnonRecord(RecordDecl *RD) {
+void FFIBindingsUtils::addToUnresolvedDeclarations(
+    unsigned ID, StringRef Declaration, ArrayRef<unsigned> Dependencies) {
+
+  // the text and the dependencies are copied to the arena, which is freed
+  // all at once with the rest of the resolution state
+  DeclarationInfo Info;
+  Info.isResolved = false;
+  Info.Declaration = Declaration.copy(Allocator);
+  unsigned *dependencyList = Allocator.Allocate<unsigned>(Dependencies.size());
+  std::copy(Dependencies.begin(), Dependencies.end(), dependencyList);
+  Info.dependencyList = ArrayRef<unsigned>(dependencyList, Dependencies.size());
+  getUnresolvedDeclarations()->insert(std::make_pair(ID, Info));
+  stats.updatePeak(FFIBindingsStats::PEAK_UNRESOLVED_DECLS,
+                   getUnresolvedDeclarations()->size());
+}
 
-  std::string AnonRecordName =
-      RD->getTypeForDecl()->getCanonicalTypeInternal().getAsString();
-  std::string RecordDeclaration;
-  std::vector<std::string> *dependencyList = new std::vector<std::string>();
-  bool isResolved = true;
+void FFIBindingsUtils::printDeclaration(unsigned ID,
+                                        const std::string &Declaration) {
 
-  char separator;
-#ifdef LLVM_ON_UNIX
-  separator = '/';
-#else
-  separator = '\\';
-#endif
-
-  unsigned int j = 0;
-  int distance;
-  for (std::vector<std::string>::iterator i = getAnonymousRecords()->begin();
-       i != getAnonymousRecords()->end(); ++i) {
-    if (*i == AnonRecordName) {
-      distance = std::distance(getAnonymousRecords()->begin(), i);
-      break;
+  writeDeclaration(*output, ID, Declaration);
+  stats.increment(FFIBindingsStats::RESOLVED_DIRECTLY);
+}
+
+void FFIBindingsUtils::writeDeclaration(llvm::raw_ostream &OS, unsigned ID,
+                                        StringRef Declaration,
+                                        ArrayRef<unsigned> Dependencies) {
+
+  if (getDepFileName() != "") {
+    SourceManager &SM = Context->getSourceManager();
+    FileID File = SM.getFileID(SM.getExpansionLoc(Decls[ID]->getLocation()));
+    if (const FileEntry *FE = SM.getFileEntryForID(File))
+      ContributingFiles.insert(FE);
+  }
+
+  if ((isCTypesModeOn() || isLayoutModeOn()) &&
+      (isa<RecordDecl>(Decls[ID]) || isa<TypedefNameDecl>(Decls[ID])))
+    WrittenTypeDecls.push_back(ID);
+
+  if (isIndexModeOn()) {
+    std::string Text;
+    llvm::raw_string_ostream TextOS(Text);
+    writeDeclarationText(TextOS, Declaration);
+    addToIndex(ID, false, TextOS.str(), Dependencies);
+  }
+
+  if (!isLazyModeOn()) {
+    writeDeclarationText(OS, Declaration);
+    OS << "\n";
+  } else {
+    beginLazyEntry(OS, getDeclName(ID),
+                   isa<FunctionDecl>(Decls[ID]) ? "function" : "type");
+    writeDeclarationText(OS, Declaration);
+    OS << "]], ";
+    writeLazyDependencies(OS, Dependencies);
+    llvm::DenseMap<unsigned, unsigned>::iterator Forward =
+        ForwardDeclarations.find(ID);
+    if (Forward != ForwardDeclarations.end())
+      OS << ", " << Forward->second;
+    OS << "}\n";
+  }
+
+  llvm::DenseMap<unsigned, PointerVariant>::iterator Variant =
+      PointerVariants.find(ID);
+  if (Variant != PointerVariants.end())
+    writePointerVariant(OS, ID, Variant->second);
+}
+
+void FFIBindingsUtils::writePointerVariant(llvm::raw_ostream &OS, unsigned ID,
+                                           const PointerVariant &Variant) {
+
+  if (isIndexModeOn()) {
+    std::string Text;
+    llvm::raw_string_ostream TextOS(Text);
+    writeDeclarationText(TextOS, Variant.Declaration);
+    addToIndex(ID, false, TextOS.str(), Variant.Dependencies, Variant.Name);
+  }
+
+  if (!isLazyModeOn()) {
+    writeDeclarationText(OS, Variant.Declaration);
+    OS << "\n";
+    return;
+  }
+
+  beginLazyEntry(OS, Variant.Name, "function");
+  writeDeclarationText(OS, Variant.Declaration);
+  OS << "]], ";
+  writeLazyDependencies(OS, Variant.Dependencies);
+  OS << "}\n";
+}
+
+void FFIBindingsUtils::writeLazyDependencies(llvm::raw_ostream &OS,
+                                             ArrayRef<unsigned> Dependencies) {
+
+  OS << "{";
+  for (unsigned i = 0; i < Dependencies.size(); i++) {
+    if (i > 0)
+      OS << ", ";
+    OS << "\"";
+    OS.write_escaped(getDeclName(Dependencies[i]));
+    OS << "\"";
+  }
+  OS << "}";
+}
+
+void FFIBindingsUtils::writeMacroDeclaration(llvm::raw_ostream &OS,
+                                             StringRef Name, StringRef Kind,
+                                             StringRef Declaration) {
+
+  if (!isLazyModeOn()) {
+    writeDeclarationText(OS, Declaration);
+    OS << "\n";
+    return;
+  }
+
+  beginLazyEntry(OS, Name, Kind);
+  writeDeclarationText(OS, Declaration);
+  OS << "]], {}}\n";
+}
+
+void FFIBindingsUtils::beginLazyEntry(llvm::raw_ostream &OS, StringRef Name,
+                                      StringRef Kind) {
+
+  // the constants of a Lua function are limited in number, so the entries
+  // are split into functions
+  if (NumWrittenDeclarations > 0 &&
+      NumWrittenDeclarations % constants::LUA_ENTRIES_PER_FUNCTION == 0)
+    OS << "end)(declarations)\n;(function(d)\n";
+
+  // d[name] = {kind, position, declaration, dependencies, position of the
+  // forward declaration}
+  OS << "d[\"";
+  OS.write_escaped(Name);
+  OS << "\"] = {\"" << Kind << "\", " << NumWrittenDeclarations++ << ", [[\n";
+}
+
+std::vector<std::string> FFIBindingsUtils::getContributingFiles() {
+
+  std::vector<std::string> Files;
+  for (const FileEntry *FE : ContributingFiles)
+    Files.push_back(FE->getName());
+  return Files;
+}
+
+void FFIBindingsUtils::writeForwardDeclaration(llvm::raw_ostream &OS,
+                                               unsigned ID) {
+
+  if (isIndexModeOn())
+    addToIndex(ID, true, getDeclName(ID) + ";", ArrayRef<unsigned>());
+
+  // the loader puts the forward declaration in its place when the
+  // declaration is defined
+  if (isLazyModeOn()) {
+    ForwardDeclarations[ID] = NumWrittenDeclarations++;
+    return;
+  }
+
+  OS << getDeclName(ID) << ";\n";
+}
+
+void FFIBindingsUtils::addToIndex(unsigned ID, bool isForwardDeclaration,
+                                  StringRef Text,
+                                  ArrayRef<unsigned> Dependencies,
+                                  StringRef Name) {
+
+  llvm::MD5 Hash;
+  Hash.update(Text);
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  llvm::SmallString<32> ResultString;
+  llvm::MD5::stringifyResult(Result, ResultString);
+
+  IndexEntry Entry;
+  Entry.ID = ID;
+  Entry.isForwardDeclaration = isForwardDeclaration;
+  Entry.Hash = ResultString.str();
+  Entry.Dependencies.assign(Dependencies.begin(), Dependencies.end());
+  Entry.Name = Name;
+  IndexEntries.push_back(Entry);
+}
+
+void FFIBindingsUtils::writeIndex(llvm::raw_ostream &OS) {
+
+  SourceManager &SM = Context->getSourceManager();
+  for (const IndexEntry &Entry : IndexEntries) {
+    Decl *D = Decls[Entry.ID];
+    const char *Kind = "typedef";
+    if (Entry.isForwardDeclaration)
+      Kind = "forward";
+    else if (isa<FunctionDecl>(D))
+      Kind = "function";
+    else if (isa<RecordDecl>(D))
+      Kind = "record";
+    else if (isa<EnumDecl>(D))
+      Kind = "enum";
+
+    OS << "{\"key\": \"";
+    writeJSONString(OS, Entry.Name != "" ? Entry.Name : getDeclName(Entry.ID));
+    OS << "\", \"kind\": \"" << Kind << "\", \"hash\": \"" << Entry.Hash
+       << "\"";
+    PresumedLoc Location =
+        SM.getPresumedLoc(SM.getExpansionLoc(D->getLocation()));
+    if (Location.isValid()) {
+      OS << ", \"file\": \"";
+      writeJSONString(OS, Location.getFilename());
+      OS << "\", \"line\": " << Location.getLine()
+         << ", \"column\": " << Location.getColumn();
+    }
+    OS << ", \"deps\": [";
+    for (unsigned i = 0; i < Entry.Dependencies.size(); i++) {
+      OS << (i > 0 ? ", \"" : "\"");
+      writeJSONString(OS, getDeclName(Entry.Dependencies[i]));
+      OS << "\"";
+    }
+    OS << "]}\n";
+  }
+}
+
+void FFIBindingsUtils::writeCTypes(llvm::raw_ostream &OS) {
+
+  OS << "\nlocal ctypes = {}\n;(function(t)\n";
+  for (unsigned i = 0; i < WrittenTypeDecls.size(); i++) {
+    if (i > 0 && i % constants::LUA_ENTRIES_PER_FUNCTION == 0)
+      OS << "end)(ctypes)\n;(function(t)\n";
+
+    std::string Name = getDeclName(WrittenTypeDecls[i]);
+    std::vector<std::string> CTypes(1, Name);
+
+    // arrays can only be made of complete object types; a record with a
+    // flexible array member is itself allocated with a length
+    QualType Type =
+        Context->getTypeDeclType(cast<TypeDecl>(Decls[WrittenTypeDecls[i]]));
+    bool hasFlexibleArrayMember = false;
+    if (const RecordType *RT = Type->getAs<RecordType>())
+      hasFlexibleArrayMember = RT->getDecl()->hasFlexibleArrayMember();
+    if (!Type->isIncompleteType() && !Type->isFunctionType() &&
+        !hasFlexibleArrayMember)
+      CTypes.push_back(Name + "[?]");
+
+    for (const std::string &CType : CTypes) {
+      OS << "t[\"";
+      OS.write_escaped(CType);
+      OS << "\"] = ffi.typeof(\"";
+      OS.write_escaped(CType);
+      OS << "\")\n";
     }
-    j++;
   }
-  if (j == getAnonymousRecords()->size()) {
-    getAnonymousRecords()->push_back(AnonRecordName);
-    distance = getAnonymousRecords()->size() - 1;
+  OS << "end)(ctypes)\nreturn ctypes\n";
+}
+
+void FFIBindingsUtils::writeDeclarationText(llvm::raw_ostream &OS,
+                                            StringRef Declaration) {
+
+  if (!isCompactModeOn()) {
+    OS << Declaration;
+    return;
+  }
+
+  // a line break is only needed as a separator between two tokens, so it
+  // is dropped after punctuation and replaced with a space otherwise
+  char Last = '\0';
+  for (char c : Declaration) {
+    if (c == '\n') {
+      if (Last == '\0' || Last == ';' || Last == '{' || Last == '}' ||
+          Last == ' ')
+        continue;
+      c = ' ';
+    }
+    OS << c;
+    Last = c;
   }
+}
+
+QualType FFIBindingsUtils::foldTypedefChain(QualType Type) {
 
-  int firstindex;
-  if (AnonRecordName.find_last_of(separator) == std::string::npos)
-    firstindex = AnonRecordName.find("at ") + 2;
-  else
-    firstindex = AnonRecordName.find_last_of(separator);
+  while (const TypedefType *TT = Type->getAs<TypedefType>()) {
+    TypedefNameDecl *TD = TT->getDecl();
+    if (isOnBlacklist(getDeclID(TD)))
+      break;
 
-  AnonRecordName = AnonRecordName.substr(
-      firstindex + 1, AnonRecordName.find_first_of(':') - firstindex - 1);
-  std::replace(AnonRecordName.begin(), AnonRecordName.end(), '.', '_');
-  std::replace(AnonRecordName.begin(), AnonRecordName.end(), '-', '_');
-  AnonRecordName =
-      "Anonymous_" + AnonRecordName + "_" + std::to_string(distance);
+    // the typedef is the only name of an unnamed record or enum, so it can't
+    // be skipped
+    QualType UnderlyingType = TD->getUnderlyingType();
+    if (!UnderlyingType->getAs<TypedefType>()) {
+      if (const TagType *Tag = UnderlyingType->getAs<TagType>()) {
+        if (Tag->getDecl()->getNameAsString() == "")
+          break;
+      }
+    }
+
+    Type = UnderlyingType.withCVRQualifiers(Type.getLocalCVRQualifiers());
+  }
+  return Type;
+}
+
+bool FFIBindingsUtils::isIncompletePointee(QualType PointeeType) {
+
+  // the marked declarations keep their full view of the types they point to
+  if (!isCompactModeOn() || ResolvingMarkedDecls)
+    return false;
+
+  if (PointeeType->getAs<TypedefType>())
+    return false;
+
+  const RecordType *RT = PointeeType->getAs<RecordType>();
+  return RT && RT->getDecl()->getNameAsString() != "";
+}
+
+void FFIBindingsUtils::resolveAnonRecord(RecordDecl *RD) {
+
+  unsigned RecordID = getDeclID(RD);
+  std::string AnonRecordName = getAnonRecordName(RD);
+  std::string RecordDeclaration;
+  llvm::SmallVector<unsigned, 8> dependencyList;
+  bool isResolved = true;
 
   std::string attrs = getDeclAttrs(RD);
 
-  if (RD->getTypeForDecl()->isStructureType()) {
+  if (RD->getTypeForDecl()->isStructureType())
     RecordDeclaration = "struct " + attrs + AnonRecordName;
-    AnonRecordName = "struct " + AnonRecordName;
-  } else if (RD->getTypeForDecl()->isUnionType()) {
+  else if (RD->getTypeForDecl()->isUnionType())
     RecordDeclaration = "union " + attrs + AnonRecordName;
-    AnonRecordName = "union " + AnonRecordName;
-  }
 
   RecordDeclaration += " {\n";
   // check the fields
   for (RecordDecl::field_iterator FI = RD->field_begin(); FI != RD->field_end();
        ++FI) {
     std::string FieldDeclaration = FI->getNameAsString();
-    checkType(FI->getType(), &isResolved, dependencyList, FieldDeclaration,
+    checkType(FI->getType(), &isResolved, &dependencyList, FieldDeclaration,
               NORMAL, NONE);
     RecordDeclaration += FieldDeclaration + ";\n";
   }
   RecordDeclaration += "};\n";
 
   if (isResolved) {
-    getResolvedDecls()->insert(AnonRecordName);
-    (*output) += RecordDeclaration;
-    (*output) += "\n";
-    delete dependencyList;
+    addToResolvedDecls(RecordID);
+    printDeclaration(RecordID, RecordDeclaration);
   } else {
     // add this record to list of unresolved declarations
-    DeclarationInfo RecordDeclarationInfo;
-    RecordDeclarationInfo.isResolved = isResolved;
-    RecordDeclarationInfo.dependencyList = dependencyList;
-    RecordDeclarationInfo.Declaration = RecordDeclaration;
-
-    std::pair<std::string, DeclarationInfo> Record(AnonRecordName,
-                                                   RecordDeclarationInfo);
-    getUnresolvedDeclarations()->insert(Record);
+    addToUnresolvedDeclarations(RecordID, RecordDeclaration, dependencyList);
   }
 }
 
@@ -218,21 +606,26 @@ void FFIBindingsUtils::resolveEnumDecl(EnumDecl *ED) {
       EnumDeclaration += elements[i] + "};\n";
   }
 
-  (*output) += EnumDeclaration; // print the enumeration
-  (*output) += "\n";
-  getResolvedDecls()->insert("enum " + ED->getNameAsString());
+  printDeclaration(getDeclID(ED), EnumDeclaration); // print the enumeration
+  addToResolvedDecls(getDeclID(ED));
 }
 
 void FFIBindingsUtils::resolveFunctionDecl(FunctionDecl *FD) {
 
   bool isResolved = true;
+  unsigned FunctionID = getDeclID(FD);
   std::string FunctionDeclaration;
-  std::vector<std::string> *dependencyList = new std::vector<std::string>();
+  llvm::SmallVector<unsigned, 8> dependencyList;
 
   const FunctionType *FT = FD->getFunctionType();
 
+  // a function that can't be called directly is bound to its exported
+  // wrapper in the shim
+  bool hasShim = needsShim(FD);
+  bool isWrapped = hasShim && ShimWriter::needsWrapper(FD);
+
   StorageClass storageClass = FD->getStorageClass();
-  switch (storageClass) {
+  switch (isWrapped ? SC_None : storageClass) {
   case SC_Static:
     FunctionDeclaration = "static ";
     break;
@@ -247,26 +640,23 @@ void FFIBindingsUtils::resolveFunctionDecl(FunctionDecl *FD) {
   QualType ReturnType = FT->getReturnType();
 
   std::string ReturnValueDeclaration;
-  checkType(ReturnType, &isResolved, dependencyList, ReturnValueDeclaration,
+  checkType(ReturnType, &isResolved, &dependencyList, ReturnValueDeclaration,
             FUNCTION, RETVAL);
 
   FunctionDeclaration += ReturnValueDeclaration + " ";
   FunctionDeclaration += FD->getQualifiedNameAsString() + "(";
 
-  if (FD->getNumParams() == 0)
-    FunctionDeclaration += ");\n";
-  else {
+  if (FD->getNumParams() != 0) {
     unsigned int i = 0;
     // check function parameters
     for (ParmVarDecl *PVD : FD->params()) {
       QualType ParameterType = PVD->getType();
-      std::string Type = ParameterType.getAsString();
       std::string Name = PVD->getNameAsString();
       std::string ParameterDeclaration = Name;
       // if the parameter is (or a pointer to, or an array of) a record,
       // enumeration or typedef type, it should be resolved and printed before
       // this function's declaration
-      checkType(ParameterType, &isResolved, dependencyList,
+      checkType(ParameterType, &isResolved, &dependencyList,
                 ParameterDeclaration, FUNCTION, PARAM);
       FunctionDeclaration += ParameterDeclaration;
 
@@ -277,32 +667,101 @@ void FFIBindingsUtils::resolveFunctionDecl(FunctionDecl *FD) {
 
     if (FD->isVariadic())
       FunctionDeclaration += ", ...";
+  }
+  FunctionDeclaration += ")";
 
-    FunctionDeclaration += ");\n";
+  if (isWrapped) {
+    FunctionDeclaration += " __asm__(\"" +
+                           ShimWriter::getWrapperName(FD->getNameAsString()) +
+                           "\")";
+    Shim.addWrapper(FD);
+  }
+  FunctionDeclaration += ";\n";
+
+  // the variant that passes records through pointers is written right
+  // after the function
+  if (hasShim && ShimWriter::hasRecordByValue(FD)) {
+    addPointerVariant(FD, FunctionID, &isResolved, &dependencyList);
+    Shim.addPointerWrapper(FD);
   }
 
   if (isResolved) {
-    getResolvedDecls()->insert("function " + FD->getQualifiedNameAsString());
-    (*output) += FunctionDeclaration;
-    (*output) += "\n";
-    delete dependencyList;
+    addToResolvedDecls(FunctionID);
+    printDeclaration(FunctionID, FunctionDeclaration);
+  } else {
+    addToUnresolvedDeclarations(FunctionID, FunctionDeclaration,
+                                dependencyList);
+  }
+}
+
+bool FFIBindingsUtils::needsShim(FunctionDecl *FD) {
+
+  if (!isShimModeOn() ||
+      (!ShimWriter::needsWrapper(FD) && !ShimWriter::hasRecordByValue(FD)))
+    return false;
+  if (ShimWriter::canBeWrapped(FD))
+    return true;
+
+  // the function is bound as it is declared
+  DiagnosticsEngine &DE = Context->getDiagnostics();
+  unsigned DiagID = DE.getCustomDiagID(
+      DiagnosticsEngine::Warning, "ffi-gen: '%0' will not be wrapped by the "
+                                  "shim because it isn't declared in a "
+                                  "header");
+  DE.Report(FD->getLocation(), DiagID) << FD->getNameAsString();
+  return false;
+}
+
+void FFIBindingsUtils::addPointerVariant(
+    FunctionDecl *FD, unsigned FunctionID, bool *isResolved,
+    SmallVectorImpl<unsigned> *dependencyList) {
+
+  std::string Name = FD->getNameAsString();
+  llvm::SmallVector<unsigned, 8> variantDependencyList;
+  QualType ReturnType = FD->getReturnType();
+  std::string Declaration;
+  std::string Parameters;
+
+  if (ReturnType->isRecordType()) {
+    Declaration = "void ";
+    Parameters = "ffi_result";
+    checkType(Context->getPointerType(ReturnType), isResolved,
+              &variantDependencyList, Parameters, FUNCTION, PARAM);
   } else {
-    DeclarationInfo FunctionDeclarationInfo;
-    FunctionDeclarationInfo.isResolved = isResolved;
-    FunctionDeclarationInfo.dependencyList = dependencyList;
-    FunctionDeclarationInfo.Declaration = FunctionDeclaration;
+    checkType(ReturnType, isResolved, &variantDependencyList, Declaration,
+              FUNCTION, RETVAL);
+    Declaration += " ";
+  }
 
-    std::pair<std::string, DeclarationInfo> Function(
-        "function " + FD->getQualifiedNameAsString(), FunctionDeclarationInfo);
-    getUnresolvedDeclarations()->insert(Function);
+  for (ParmVarDecl *PVD : FD->params()) {
+    QualType ParameterType = PVD->getType();
+    if (ParameterType->isRecordType())
+      ParameterType = Context->getPointerType(ParameterType.withConst());
+    std::string ParameterDeclaration = PVD->getNameAsString();
+    checkType(ParameterType, isResolved, &variantDependencyList,
+              ParameterDeclaration, FUNCTION, PARAM);
+    if (Parameters != "")
+      Parameters += ", ";
+    Parameters += ParameterDeclaration;
   }
+
+  PointerVariant &Variant = PointerVariants[FunctionID];
+  Variant.Name = ShimWriter::getPointerVariantName(Name);
+  Variant.Declaration = Declaration + Variant.Name + "(" + Parameters +
+                        ") __asm__(\"" +
+                        ShimWriter::getWrapperName(Variant.Name) + "\");\n";
+  Variant.Dependencies.assign(variantDependencyList.begin(),
+                              variantDependencyList.end());
+  dependencyList->append(variantDependencyList.begin(),
+                         variantDependencyList.end());
 }
 
 void FFIBindingsUtils::resolveRecordDecl(RecordDecl *RD) {
 
   bool isResolved = true;
+  unsigned RecordID = getDeclID(RD);
   std::string RecordDeclaration;
-  std::vector<std::string> *dependencyList = new std::vector<std::string>();
+  llvm::SmallVector<unsigned, 8> dependencyList;
 
   std::string attrList = getDeclAttrs(RD);
 
@@ -323,76 +782,60 @@ void FFIBindingsUtils::resolveRecordDecl(RecordDecl *RD) {
       continue;
     }
     std::string FieldDeclaration = FI->getNameAsString();
-    checkType(FI->getType(), &isResolved, dependencyList, FieldDeclaration,
+    checkType(FI->getType(), &isResolved, &dependencyList, FieldDeclaration,
               NORMAL, NONE);
     RecordDeclaration += FieldDeclaration + ";\n";
   }
   RecordDeclaration += "};\n";
   if (isResolved) {
-    getResolvedDecls()->insert(
-        RD->getTypeForDecl()->getCanonicalTypeInternal().getAsString());
+    addToResolvedDecls(RecordID);
     if (RD->field_empty())
-      (*output) +=
-          RD->getTypeForDecl()->getCanonicalTypeInternal().getAsString() +
-          ";\n";
+      printDeclaration(RecordID, getDeclName(RecordID) + ";\n");
     else
-      (*output) += RecordDeclaration;
-    (*output) += "\n";
-
-    delete dependencyList;
+      printDeclaration(RecordID, RecordDeclaration);
   } else {
     // add this record to list of unresolved declarations
-    DeclarationInfo RecordDeclarationInfo;
-    RecordDeclarationInfo.isResolved = isResolved;
-    RecordDeclarationInfo.dependencyList = dependencyList;
-    RecordDeclarationInfo.Declaration = RecordDeclaration;
-
-    std::pair<std::string, DeclarationInfo> Record(
-        RD->getTypeForDecl()->getCanonicalTypeInternal().getAsString(),
-        RecordDeclarationInfo);
-    getUnresolvedDeclarations()->insert(Record);
+    addToUnresolvedDeclarations(RecordID, RecordDeclaration, dependencyList);
   }
 }
 
 void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
 
   std::string TypedefDeclaration = "typedef ";
+  unsigned TypedefID = getDeclID(TD);
 
+  // in compact mode a typedef of a typedef is emitted as a typedef of the
+  // type at the end of the chain, so the typedefs in between are emitted only
+  // if something else uses them
   QualType UnderlyingTypeFull = TD->getUnderlyingType();
-  QualType UnderlyingType = TD->getUnderlyingType();
+  if (isCompactModeOn())
+    UnderlyingTypeFull = foldTypedefChain(UnderlyingTypeFull);
+  QualType UnderlyingType = UnderlyingTypeFull;
   unsigned Qualifiers = UnderlyingType.getLocalCVRQualifiers();
   UnderlyingType.removeLocalCVRQualifiers(Qualifiers);
 
   if (const TypedefType *TT = UnderlyingType->getAs<TypedefType>()) {
 
     TypedefNameDecl *typedefDecl = TT->getDecl();
+    unsigned UnderlyingID = getDeclID(typedefDecl);
     std::string TypedefDeclaration = "typedef " +
                                      UnderlyingTypeFull.getAsString() + " " +
                                      TD->getNameAsString() + ";\n";
 
-    if (isOnBlacklist(UnderlyingType.getAsString()))
-      getResolvedDecls()->insert("typedef " + TD->getNameAsString());
+    if (isOnBlacklist(UnderlyingID))
+      addToResolvedDecls(TypedefID);
     else {
-      bool isResolved = false;
-      std::vector<std::string> *dependencyList = new std::vector<std::string>();
+      llvm::SmallVector<unsigned, 8> dependencyList;
 
       TypeDeclaration TypedefTypeDeclaration;
       TypedefTypeDeclaration.Declaration = typedefDecl;
-      TypedefTypeDeclaration.TypeName =
-          "typedef " + UnderlyingType.getAsString();
-      dependencyList->push_back("typedef " + UnderlyingType.getAsString());
-
-      DeclarationInfo TypedefDeclarationInfo;
-      TypedefDeclarationInfo.isResolved = isResolved;
-      TypedefDeclarationInfo.dependencyList = dependencyList;
-      TypedefDeclarationInfo.Declaration = TypedefDeclaration;
+      TypedefTypeDeclaration.ID = UnderlyingID;
+      dependencyList.push_back(UnderlyingID);
 
-      std::pair<std::string, DeclarationInfo> TypedefDecl(
-          "typedef " + TD->getNameAsString(), TypedefDeclarationInfo);
+      addToUnresolvedDeclarations(TypedefID, TypedefDeclaration,
+                                  dependencyList);
 
-      getUnresolvedDeclarations()->insert(TypedefDecl);
-
-      if (isNewType(UnderlyingType))
+      if (isNewType(UnderlyingID))
         getDeclsToFind()->push(TypedefTypeDeclaration);
     }
 
@@ -400,22 +843,20 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
 
     TypedefDeclaration +=
         UnderlyingTypeFull.getAsString() + " " + TD->getNameAsString() + ";\n";
-    getResolvedDecls()->insert("typedef " + TD->getNameAsString());
-    (*output) += TypedefDeclaration;
-    (*output) += "\n";
+    addToResolvedDecls(TypedefID);
+    printDeclaration(TypedefID, TypedefDeclaration);
 
   } else if (UnderlyingType->isRecordType()) {
 
     bool isResolved = false;
-    std::vector<std::string> *dependencyList = new std::vector<std::string>();
+    llvm::SmallVector<unsigned, 8> dependencyList;
 
     const RecordType *RT = UnderlyingType->getAs<RecordType>();
     RecordDecl *recordDecl = RT->getDecl();
+    unsigned RecordID = getDeclID(recordDecl);
 
-    if (isOnBlacklist(UnderlyingType.getAsString())) {
-      getResolvedDecls()->insert(recordDecl->getTypeForDecl()
-                                     ->getCanonicalTypeInternal()
-                                     .getAsString());
+    if (isOnBlacklist(RecordID)) {
+      addToResolvedDecls(RecordID);
       TypedefDeclaration += UnderlyingTypeFull.getAsString() + " ";
     } else {
       if (recordDecl->getNameAsString() == "") {
@@ -432,7 +873,7 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
         for (RecordDecl::field_iterator FI = recordDecl->field_begin();
              FI != recordDecl->field_end(); ++FI) {
           std::string FieldDeclaration = FI->getNameAsString();
-          checkType(FI->getType(), &isResolved, dependencyList,
+          checkType(FI->getType(), &isResolved, &dependencyList,
                     FieldDeclaration, NORMAL, NONE);
           AnonRecordDeclaration += FieldDeclaration + ";\n";
         }
@@ -441,16 +882,12 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
 
       } else {
         TypedefDeclaration += UnderlyingTypeFull.getAsString() + " ";
-        dependencyList->push_back(recordDecl->getTypeForDecl()
-                                      ->getCanonicalTypeInternal()
-                                      .getAsString());
+        dependencyList.push_back(RecordID);
 
-        if (isNewType(UnderlyingType)) {
+        if (isNewType(RecordID)) {
           TypeDeclaration RecordTypeDeclaration;
           RecordTypeDeclaration.Declaration = recordDecl;
-          RecordTypeDeclaration.TypeName = recordDecl->getTypeForDecl()
-                                               ->getCanonicalTypeInternal()
-                                               .getAsString();
+          RecordTypeDeclaration.ID = RecordID;
           getDeclsToFind()->push(RecordTypeDeclaration);
         }
       }
@@ -458,15 +895,7 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
 
     TypedefDeclaration += TD->getNameAsString() + ";\n";
 
-    DeclarationInfo TypedefDeclarationInfo;
-    TypedefDeclarationInfo.isResolved = isResolved;
-    TypedefDeclarationInfo.dependencyList = dependencyList;
-    TypedefDeclarationInfo.Declaration = TypedefDeclaration;
-
-    std::pair<std::string, DeclarationInfo> TypedefDecl(
-        "typedef " + TD->getNameAsString(), TypedefDeclarationInfo);
-
-    getUnresolvedDeclarations()->insert(TypedefDecl);
+    addToUnresolvedDeclarations(TypedefID, TypedefDeclaration, dependencyList);
 
   } else if (UnderlyingType->isEnumeralType()) {
 
@@ -474,8 +903,10 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
     EnumDecl *enumDecl = ET->getDecl();
     std::string TypedefDeclaration = "typedef enum ";
 
-    if (isOnBlacklist(UnderlyingType.getAsString())) {
-      getResolvedDecls()->insert(UnderlyingType.getAsString());
+    unsigned EnumID = getDeclID(enumDecl);
+
+    if (isOnBlacklist(EnumID)) {
+      addToResolvedDecls(EnumID);
       TypedefDeclaration += enumDecl->getNameAsString() + " ";
     } else {
 
@@ -509,22 +940,21 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
       }
     }
     TypedefDeclaration += TD->getNameAsString() + ";\n";
-    (*output) += TypedefDeclaration; // print the typedef
-    (*output) += "\n";
+    printDeclaration(TypedefID, TypedefDeclaration); // print the typedef
 
-    getResolvedDecls()->insert("typedef " + TD->getNameAsString());
+    addToResolvedDecls(TypedefID);
 
   } else if (UnderlyingType->isFunctionPointerType()) {
 
     std::string FunctionPointerDeclarationCore;
     bool isResolved = false;
-    std::vector<std::string> *dependencyList = new std::vector<std::string>();
+    llvm::SmallVector<unsigned, 8> dependencyList;
     const FunctionProtoType *FPT =
         (const FunctionProtoType *)
         UnderlyingType->getPointeeType()->getAs<FunctionType>();
     std::string ReturnValueDeclaration;
 
-    checkType(FPT->getReturnType(), &isResolved, dependencyList,
+    checkType(FPT->getReturnType(), &isResolved, &dependencyList,
               ReturnValueDeclaration, FUNCTION, RETVAL);
     std::string TypedefDeclaration = "typedef " + ReturnValueDeclaration +
                                      " (*" + TD->getNameAsString() + ")" + "(";
@@ -532,7 +962,7 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
     unsigned int NumOfParams = FPT->getNumParams();
     for (unsigned int i = 0; i < NumOfParams; i++) {
       std::string ParameterDeclaration;
-      checkType(FPT->getParamType(i), &isResolved, dependencyList,
+      checkType(FPT->getParamType(i), &isResolved, &dependencyList,
                 ParameterDeclaration, FUNCTION, PARAM);
       FunctionPointerDeclarationCore += ParameterDeclaration;
       if (i != NumOfParams - 1)
@@ -545,20 +975,12 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
     FunctionPointerDeclarationCore += ");\n";
     TypedefDeclaration += FunctionPointerDeclarationCore;
 
-    DeclarationInfo TypedefDeclarationInfo;
-    TypedefDeclarationInfo.isResolved = isResolved;
-    TypedefDeclarationInfo.dependencyList = dependencyList;
-    TypedefDeclarationInfo.Declaration = TypedefDeclaration;
-
-    std::pair<std::string, DeclarationInfo> TypedefDecl(
-        "typedef " + TD->getNameAsString(), TypedefDeclarationInfo);
-
-    getUnresolvedDeclarations()->insert(TypedefDecl);
+    addToUnresolvedDeclarations(TypedefID, TypedefDeclaration, dependencyList);
 
   } else if (UnderlyingType->isPointerType()) {
 
     bool isResolved = false;
-    std::vector<std::string> *dependencyList = new std::vector<std::string>();
+    llvm::SmallVector<unsigned, 8> dependencyList;
     std::string TypedefDeclaration = "typedef ";
     std::string ElementType;
 
@@ -569,35 +991,25 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
       isResolved = true;
     } else {
       std::string DeclarationCore = "(*" + TD->getNameAsString() + ")";
-      checkType(UnderlyingType->getPointeeType(), &isResolved, dependencyList,
+      checkType(UnderlyingType->getPointeeType(), &isResolved, &dependencyList,
                 DeclarationCore, NORMAL, NONE);
 
       TypedefDeclaration += DeclarationCore + ";\n";
       isResolved = false;
 
-      DeclarationInfo TypedefDeclarationInfo;
-      TypedefDeclarationInfo.isResolved = isResolved;
-      TypedefDeclarationInfo.dependencyList = dependencyList;
-      TypedefDeclarationInfo.Declaration = TypedefDeclaration;
-
-      std::pair<std::string, DeclarationInfo> TypedefDecl(
-          "typedef " + TD->getNameAsString(), TypedefDeclarationInfo);
-
-      getUnresolvedDeclarations()->insert(TypedefDecl);
+      addToUnresolvedDeclarations(TypedefID, TypedefDeclaration,
+                                  dependencyList);
     }
     if (isResolved) {
-      getResolvedDecls()->insert("typedef " + TD->getNameAsString());
-      (*output) += TypedefDeclaration; // print the typedef
-      (*output) += "\n";
-
-      delete dependencyList;
+      addToResolvedDecls(TypedefID);
+      printDeclaration(TypedefID, TypedefDeclaration); // print the typedef
     }
   } else if (UnderlyingType->isArrayType()) {
 
     std::string TypedefDeclaration = "typedef ";
 
     bool isResolved = false;
-    std::vector<std::string> *dependencyList = new std::vector<std::string>();
+    llvm::SmallVector<unsigned, 8> dependencyList;
     std::string DeclarationCore = TD->getNameAsString();
 
     std::string ArrayDeclaration;
@@ -615,20 +1027,13 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
     }
 
     DeclarationCore += ArrayDeclaration;
-    checkType(ElementType, &isResolved, dependencyList, DeclarationCore, NORMAL,
-              NONE);
+    checkType(ElementType, &isResolved, &dependencyList, DeclarationCore,
+              NORMAL, NONE);
 
     TypedefDeclaration += DeclarationCore + ";\n";
 
-    DeclarationInfo TypedefDeclarationInfo;
-    TypedefDeclarationInfo.isResolved = isResolved;
-    TypedefDeclarationInfo.dependencyList = dependencyList;
-    TypedefDeclarationInfo.Declaration = TypedefDeclaration;
-
-    std::pair<std::string, DeclarationInfo> TypedefDecl(
-        "typedef " + TD->getNameAsString(), TypedefDeclarationInfo);
-
-    getUnresolvedDeclarations()->insert(TypedefDecl);
+    addToUnresolvedDeclarations(TypedefID, TypedefDeclaration,
+                                dependencyList);
 
   } else if (const VectorType *VT = UnderlyingType->getAs<VectorType>()) {
 
@@ -639,19 +1044,91 @@ void FFIBindingsUtils::resolveTypedefDecl(TypedefNameDecl *TD) {
           " __attribute__((__vector_size__(" +
           std::to_string(VT->getNumElements()) + " * sizeof(" +
           VT->getElementType().getAsString() + "))));\n";
-      getResolvedDecls()->insert("typedef " + TD->getNameAsString());
-      (*output) += TypedefDeclaration;
-      (*output) += "\n";
+      addToResolvedDecls(TypedefID);
+      printDeclaration(TypedefID, TypedefDeclaration);
     }
   }
 }
 
 void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
-                                 std::vector<std::string> *dependencyList,
+                                 SmallVectorImpl<unsigned> *dependencyList,
                                  std::string &DeclarationCore,
                                  enum ParentDeclType type,
                                  enum ParamType parameterType) {
 
+  PhaseTimer Timer(&stats, FFIBindingsStats::CHECK_TYPE);
+  stats.increment(FFIBindingsStats::CHECK_TYPE_CALLS);
+
+  // the printed type depends on sugar (e.g. typedef names) and qualifiers, so
+  // the type itself is the key rather than its canonical type; whether the
+  // declarator is empty matters only because no space is put before it then,
+  // and whether marked declarations are being resolved only in compact mode
+  unsigned Kind = (type * (NONE + 1) + parameterType) << 1;
+  Kind = (Kind | (isCompactModeOn() && !ResolvingMarkedDecls)) << 1;
+  std::pair<void *, unsigned> Key(ParameterType.getAsOpaquePtr(),
+                                  Kind | DeclarationCore.empty());
+  llvm::DenseMap<std::pair<void *, unsigned>, CheckTypeResult>::iterator it =
+      CheckTypeResults.find(Key);
+
+  if (it == CheckTypeResults.end()) {
+    // the declarator is replaced with the place holder, so that the result
+    // can be used for any declarator; dependencies are only recorded while
+    // the result is computed
+    CheckTypeResult Result;
+    if (!DeclarationCore.empty())
+      Result.Declaration = constants::DECLARATOR_PLACE_HOLDER;
+    std::vector<TypeDeclaration> *OuterDependencies = CheckTypeDependencies;
+    CheckTypeDependencies = &Result.Dependencies;
+    checkTypeUncached(ParameterType, isResolved, dependencyList,
+                      Result.Declaration, type, parameterType);
+    CheckTypeDependencies = OuterDependencies;
+    it = CheckTypeResults.insert(std::make_pair(Key, std::move(Result))).first;
+  } else
+    stats.increment(FFIBindingsStats::CHECK_TYPE_MEMO_HITS);
+
+  const CheckTypeResult &Result = it->second;
+  if (DeclarationCore.empty())
+    DeclarationCore = Result.Declaration;
+  else {
+    std::string Declaration = Result.Declaration;
+    size_t Position = Declaration.find(constants::DECLARATOR_PLACE_HOLDER);
+    if (Position != std::string::npos)
+      Declaration.replace(Position, constants::DECLARATOR_PLACE_HOLDER.size(),
+                          DeclarationCore);
+    DeclarationCore.swap(Declaration);
+  }
+
+  for (const TypeDeclaration &Dependency : Result.Dependencies)
+    addTypeDependency(Dependency, isResolved, dependencyList);
+}
+
+void FFIBindingsUtils::addTypeDependency(
+    const TypeDeclaration &Dependency, bool *isResolved,
+    SmallVectorImpl<unsigned> *dependencyList) {
+
+  if (CheckTypeDependencies) {
+    CheckTypeDependencies->push_back(Dependency);
+    return;
+  }
+
+  // blacklisted declarations are only marked as resolved
+  if (!Dependency.Declaration) {
+    addToResolvedDecls(Dependency.ID);
+    return;
+  }
+
+  *isResolved = false;
+  dependencyList->push_back(Dependency.ID);
+
+  if (isNewType(Dependency.ID))
+    getDeclsToFind()->push(Dependency);
+}
+
+void FFIBindingsUtils::checkTypeUncached(
+    QualType ParameterType, bool *isResolved,
+    SmallVectorImpl<unsigned> *dependencyList, std::string &DeclarationCore,
+    enum ParentDeclType type, enum ParamType parameterType) {
+
   unsigned Qualifiers = ParameterType.getLocalCVRQualifiers();
   QualType ParamTypeFull = ParameterType;
   ParameterType.removeLocalCVRQualifiers(Qualifiers);
@@ -660,20 +1137,16 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
   // structure is both typedef type and record type
   if (const TypedefType *TT = ParameterType->getAs<TypedefType>()) {
 
-    if (isOnBlacklist(ParameterType.getAsString()))
-      getResolvedDecls()->insert("typedef " + ParameterType.getAsString());
-    else {
-      TypeDeclaration TypedefTypeDeclaration;
-      TypedefTypeDeclaration.Declaration = TT->getDecl();
-      TypedefTypeDeclaration.TypeName =
-          "typedef " + ParameterType.getAsString();
+    unsigned TypedefID = getDeclID(TT->getDecl());
 
-      *isResolved = false;
-      dependencyList->push_back("typedef " + ParameterType.getAsString());
+    TypeDeclaration TypedefTypeDeclaration;
+    TypedefTypeDeclaration.Declaration = TT->getDecl();
+    TypedefTypeDeclaration.ID = TypedefID;
+
+    if (isOnBlacklist(TypedefID))
+      TypedefTypeDeclaration.Declaration = NULL;
+    addTypeDependency(TypedefTypeDeclaration, isResolved, dependencyList);
 
-      if (isNewType(ParameterType))
-        getDeclsToFind()->push(TypedefTypeDeclaration);
-    }
     if (DeclarationCore == "")
       DeclarationCore = ParamTypeFull.getAsString();
     else
@@ -681,8 +1154,11 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
 
   } else if (const RecordType *RT = ParameterType->getAs<RecordType>()) {
 
-    if (isOnBlacklist(ParameterType.getAsString())) {
-      getResolvedDecls()->insert(ParameterType.getAsString());
+    unsigned RecordID = getDeclID(RT->getDecl());
+
+    if (isOnBlacklist(RecordID)) {
+      TypeDeclaration Blacklisted = {RecordID, NULL};
+      addTypeDependency(Blacklisted, isResolved, dependencyList);
       if (DeclarationCore == "")
         DeclarationCore = ParamTypeFull.getAsString();
       else
@@ -696,59 +1172,10 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
       if (RD->getNameAsString() == "") {
 
         if (type == FUNCTION) {
-          std::string AnonRecordName =
-              RD->getTypeForDecl()->getCanonicalTypeInternal().getAsString();
-          char separator;
-#ifdef LLVM_ON_UNIX
-          separator = '/';
-#else
-          separator = '\\';
-#endif
-
-          unsigned int j = 0;
-          int distance;
-          for (std::vector<std::string>::iterator i =
-                   getAnonymousRecords()->begin();
-               i != getAnonymousRecords()->end(); ++i) {
-            if (*i == AnonRecordName) {
-              distance = std::distance(getAnonymousRecords()->begin(), i);
-              break;
-            }
-            j++;
-          }
-          if (j == getAnonymousRecords()->size()) {
-            getAnonymousRecords()->push_back(AnonRecordName);
-            distance = getAnonymousRecords()->size() - 1;
-          }
-
-          int firstindex;
-          if (AnonRecordName.find_last_of(separator) == std::string::npos) {
-            firstindex = AnonRecordName.find("at ") + 2;
-          } else {
-            firstindex = AnonRecordName.find_last_of(separator);
-          }
-
-          AnonRecordName = AnonRecordName.substr(
-              firstindex + 1,
-              AnonRecordName.find_first_of(':') - firstindex - 1);
-          std::replace(AnonRecordName.begin(), AnonRecordName.end(), '.', '_');
-          std::replace(AnonRecordName.begin(), AnonRecordName.end(), '-', '_');
-          AnonRecordName =
-              "Anonymous_" + AnonRecordName + "_" + std::to_string(distance);
-
-          if (RT->isStructureType())
-            AnonRecordName = "struct " + AnonRecordName;
-          else if (RT->isUnionType())
-            AnonRecordName = "union " + AnonRecordName;
-
-          *isResolved = false;
-
-          RecordTypeDeclaration.TypeName = AnonRecordName;
-          dependencyList->push_back(AnonRecordName);
+          std::string AnonRecordName = getDeclName(RecordID);
 
-          if (!isInResolvedDecls(AnonRecordName) &&
-              !isInUnresolvedDeclarations(AnonRecordName))
-            getDeclsToFind()->push(RecordTypeDeclaration);
+          RecordTypeDeclaration.ID = RecordID;
+          addTypeDependency(RecordTypeDeclaration, isResolved, dependencyList);
 
           if (DeclarationCore == "")
             DeclarationCore = AnonRecordName;
@@ -783,13 +1210,8 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
         }
 
       } else {
-        RecordTypeDeclaration.TypeName = ParameterType.getAsString();
-
-        *isResolved = false;
-        dependencyList->push_back(ParameterType.getAsString());
-
-        if (isNewType(ParameterType))
-          getDeclsToFind()->push(RecordTypeDeclaration);
+        RecordTypeDeclaration.ID = RecordID;
+        addTypeDependency(RecordTypeDeclaration, isResolved, dependencyList);
 
         if (DeclarationCore == "")
           DeclarationCore = ParamTypeFull.getAsString();
@@ -800,8 +1222,11 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
 
   } else if (const EnumType *ET = ParameterType->getAs<EnumType>()) {
 
-    if (isOnBlacklist(ParameterType.getAsString())) {
-      getResolvedDecls()->insert(ParameterType.getAsString());
+    unsigned EnumID = getDeclID(ET->getDecl());
+
+    if (isOnBlacklist(EnumID)) {
+      TypeDeclaration Blacklisted = {EnumID, NULL};
+      addTypeDependency(Blacklisted, isResolved, dependencyList);
       if (DeclarationCore == "")
         DeclarationCore = ParamTypeFull.getAsString();
       else
@@ -842,13 +1267,8 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
       } else {
         TypeDeclaration EnumTypeDeclaration;
         EnumTypeDeclaration.Declaration = ED;
-        EnumTypeDeclaration.TypeName = ParameterType.getAsString();
-
-        *isResolved = false;
-        dependencyList->push_back(ParameterType.getAsString());
-
-        if (isNewType(ParameterType))
-          getDeclsToFind()->push(EnumTypeDeclaration);
+        EnumTypeDeclaration.ID = EnumID;
+        addTypeDependency(EnumTypeDeclaration, isResolved, dependencyList);
 
         if (DeclarationCore == "")
           DeclarationCore = ParamTypeFull.getAsString();
@@ -888,21 +1308,24 @@ void FFIBindingsUtils::checkType(QualType ParameterType, bool *isResolved,
 
   } else if (ParameterType->isPointerType()) {
 
-    if (type == FUNCTION) {
-      if (parameterType == RETVAL) {
-        checkType(ParameterType->getPointeeType(), isResolved, dependencyList,
-                  DeclarationCore, type, parameterType);
-        DeclarationCore += "*";
-      } else {
-        DeclarationCore = "(*" + DeclarationCore + ")";
-        checkType(ParameterType->getPointeeType(), isResolved, dependencyList,
-                  DeclarationCore, type, parameterType);
-      }
-    } else if (type == NORMAL) {
+    QualType PointeeType = ParameterType->getPointeeType();
+    bool isReturnValue = type == FUNCTION && parameterType == RETVAL;
+
+    if (!isReturnValue)
       DeclarationCore = "(*" + DeclarationCore + ")";
-      checkType(ParameterType->getPointeeType(), isResolved, dependencyList,
-                DeclarationCore, type, parameterType);
-    }
+
+    if (isIncompletePointee(PointeeType)) {
+      // the record is not a dependency, it is only named
+      if (DeclarationCore == "")
+        DeclarationCore = PointeeType.getAsString();
+      else
+        DeclarationCore = PointeeType.getAsString() + " " + DeclarationCore;
+    } else
+      checkType(PointeeType, isResolved, dependencyList, DeclarationCore, type,
+                parameterType);
+
+    if (isReturnValue)
+      DeclarationCore += "*";
   } else if (ParameterType->isArrayType()) {
     std::string ArrayDeclaration;
     QualType ElementType;
@@ -2,19 +2,24 @@
 
 bool FunctionVisitor::VisitFunctionDecl(FunctionDecl *FD) {
 
-  if (!FFIBindingsUtils::getInstance()->isTestingModeOn()) {
-    if (!FD->hasAttr<FFIBindingAttr>())
+  if (!utils->isTestingModeOn()) {
+    if (!utils->isMarked(FD))
       return true;
   }
 
-  if (FFIBindingsUtils::getInstance()->isInResolvedDecls(
-          "function " + FD->getQualifiedNameAsString()) ||
-      FFIBindingsUtils::getInstance()->isInUnresolvedDeclarations(
-          "function " + FD->getQualifiedNameAsString()))
+  unsigned FunctionID = utils->getDeclID(FD);
+
+  if (utils->isInResolvedDecls(FunctionID) ||
+      utils->isInUnresolvedDeclarations(FunctionID))
+    return true;
+
+  if (utils->isOnBlacklist(FunctionID)) {
+    utils->addToResolvedDecls(FunctionID);
     return true;
+  }
 
-  FFIBindingsUtils::getInstance()->setHasMarkedDeclarations(true);
-  FFIBindingsUtils::getInstance()->resolveFunctionDecl(FD);
+  utils->setHasMarkedDeclarations(true);
+  utils->resolveFunctionDecl(FD);
 
   return true;
 }
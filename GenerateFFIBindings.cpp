@@ -15,299 +15,17 @@
 //===----------------------------------------------------------------------===//
 
 #include "GenerateFFIBindings.hpp"
-/**
- * Class used for generating required FFI bindings by traversing through
- * the parsed AST and extracting relevant information from the
- * appropriate nodes.
- *
- * Implementation of the ASTConsumer interface.
- * It implements HandleTranslationUnit method, which gets called when
- * the AST for entire translation unit has been parsed.
- *
- **/
-class GenerateFFIBindingsConsumer : public ASTConsumer {
-public:
-  GenerateFFIBindingsConsumer() {}
-  virtual void HandleTranslationUnit(clang::ASTContext &context) {
-
-    DiagnosticsEngine &DE = context.getDiagnostics();
-    if (DE.hasErrorOccurred()) {
-      llvm::outs() << "----------------------------------\n";
-      llvm::outs() << "--------- ffi-gen plugin ---------\n";
-      llvm::outs() << "----------------------------------\n";
-      llvm::outs() << "Error has occurred during compilation ";
-      llvm::outs() << "- ffi bindings will not be generated.\n\n";
-      return;
-    }
-
-    std::error_code Err;
-    utils = FFIBindingsUtils::getInstance();
-
-    std::string outputFileName = utils->getOutputFileName();
-    std::string headerFileName = utils->getHeaderFileName();
-    std::string blacklistFileName = utils->getBlacklistFileName();
-
-    std::string sourceFileName =
-        context.getSourceManager()
-            .getFileEntryForID(context.getSourceManager().getMainFileID())
-            ->getName();
-    std::string dirName =
-        context.getSourceManager().getFileManager().getCanonicalName(
-            context.getSourceManager()
-                .getFileEntryForID(context.getSourceManager().getMainFileID())
-                ->getDir());
-
-    char separator;
-#ifdef LLVM_ON_UNIX
-    separator = '/';
-#else
-    separator = '\\';
-#endif
-    dirName += separator;
-    if (sourceFileName.find_last_of(separator) != std::string::npos)
-      sourceFileName =
-          sourceFileName.substr(sourceFileName.find_last_of(separator) + 1);
-
-    if (utils->isTestingModeOn()) {
-      outputFileName = sourceFileName;
-      outputFileName.replace(
-          outputFileName.find_first_of('.'),
-          outputFileName.length() - outputFileName.find_first_of('.'), "");
-      outputFileName = dirName + outputFileName;
-      std::replace(outputFileName.begin(), outputFileName.end(), separator,
-                   '_');
-
-      outputFileName += ".lua";
-    }
-
-    sourceFileName = ">> " + dirName + sourceFileName;
-
-    if (headerFileName != "") {
-      std::string line;
-      std::ifstream headerFile(headerFileName);
-      if (headerFile.is_open()) {
-        while (getline(headerFile, line)) {
-          if (line.find(constants::SRC_FILE_PLACE_HOLDER) != std::string::npos)
-            line.replace(line.find(constants::SRC_FILE_PLACE_HOLDER),
-                         constants::SRC_FILE_PLACE_HOLDER.length(),
-                         sourceFileName);
-          output += line + "\n";
-        }
-        headerFile.close();
-      } else {
-        llvm::outs() << "Error opening file: \"" << headerFileName << "\"\n";
-        return;
-      }
-    }
-
-    if (blacklistFileName != "") {
-      std::string line;
-      std::ifstream blacklistFile(blacklistFileName);
-      if (blacklistFile.is_open()) {
-        while (getline(blacklistFile, line)) {
-          utils->getBlacklist()->insert(line);
-        }
-        blacklistFile.close();
-      } else {
-        llvm::outs() << "Error opening file: \"" << blacklistFileName << "\"\n";
-        return;
-      }
-    }
-
-    output += "ffi = require(\"ffi\")\nffi.cdef[[\n\n";
-
-    FFIBindingsUtils::getInstance()->setOutput(&output);
-    FFIBindingsUtils::getInstance()->setContext(&context);
-
-    // visit all function declarations and extract information
-    // about unresolved dependencies, if there are any
-    FunctionsVisitor.TraverseDecl(context.getTranslationUnitDecl());
-    // visit all record declarations that are marked with ffibinding attribute
-    // and start resolving them
-    RecordsVisitor.TraverseDecl(context.getTranslationUnitDecl());
-    // visit all enum declarations that are marked with ffibinding attribute
-    // and print them out
-    EnumsVisitor.TraverseDecl(context.getTranslationUnitDecl());
-    // visit all typedef declarations that are marked with ffibinding attribute
-    // and start resolving them
-    TypedefsVisitor.TraverseDecl(context.getTranslationUnitDecl());
-
-    // go through DeclsToFind until all required declarations are found
-    while (utils->getDeclsToFind()->size() > 0) {
-
-      TypeDeclaration Decl = utils->getDeclsToFind()->top();
-      utils->getDeclsToFind()->pop();
-
-      const Type *DeclType = Decl.Declaration->getTypeForDecl();
-
-      if (!utils->isInResolvedDecls(Decl.TypeName) &&
-          !utils->isInUnresolvedDeclarations(Decl.TypeName)) {
-        if (DeclType->getAs<TypedefType>())
-          FFIBindingsUtils::getInstance()->resolveTypedefDecl(
-              (TypedefNameDecl *)Decl.Declaration);
-        else if (DeclType->isRecordType()) {
-          if (Decl.Declaration->getNameAsString() == "")
-            FFIBindingsUtils::getInstance()->resolveAnonRecord(
-                (RecordDecl *)Decl.Declaration);
-          else
-            FFIBindingsUtils::getInstance()->resolveRecordDecl(
-                (RecordDecl *)Decl.Declaration);
-        } else if (DeclType->isEnumeralType())
-          FFIBindingsUtils::getInstance()->resolveEnumDecl(
-              (EnumDecl *)Decl.Declaration);
-      }
-    }
-
-    unsigned int i = 0;
-    bool possibleLoop = false;
-
-    while (i < utils->getUnresolvedDeclarations()->size()) {
-      i = 0;
-      bool printedSomething = false;
-      // iterate through the list of unresolved declarations until
-      // they are all printed (become resolved);
-      // declaration printing must be done in a certain order
-      for (std::map<std::string, DeclarationInfo>::iterator it =
-               utils->getUnresolvedDeclarations()->begin();
-           it != utils->getUnresolvedDeclarations()->end(); ++it) {
-        std::pair<std::string, DeclarationInfo> Decl = *it;
-        std::string DeclName = Decl.first;
-        DeclarationInfo DeclInfo = Decl.second;
-        if (DeclInfo.isResolved) {
-          i++;      // increment the number of already resolved declarations
-          continue; // continue to the next one in the list
-        }
-        unsigned int j =
-            0; // a counter used for checking if all dependencies are resolved
-
-        for (std::vector<std::string>::iterator it1 =
-                 DeclInfo.dependencyList->begin();
-             it1 != DeclInfo.dependencyList->end(); ++it1) {
-          // check if this dependency is resolved
-          if (utils->isInResolvedDecls(*it1))
-            j++;
-          else
-            break;
-        }
-        if (j == DeclInfo.dependencyList->size()) { // if all dependencies of
-                                                    // this declaration are
-                                                    // resolved, it can be
-                                                    // printed out and marked as
-                                                    // resolved
-          (*it).second.isResolved = true;
-          utils->getResolvedDecls()->insert(DeclName);
-          output += DeclInfo.Declaration; // print out the declaration
-          output += "\n";
-          printedSomething = true;
-          possibleLoop = false;
-          delete DeclInfo.dependencyList;
-        } else {
-          if (possibleLoop && !utils->isInResolvedDecls(DeclName) &&
-              DependsOnItself(DeclName, DeclInfo.dependencyList)) {
-            utils->getResolvedDecls()->insert(DeclName);
-            output += DeclName; // print out the forward declaration
-            output += ";\n";
-            printedSomething = true;
-            possibleLoop = false;
-          }
-          continue; // if this declaration is not yet ready for printing, move
-                    // on to the next one in the list
-        }
-      }
-      if (!printedSomething)
-        possibleLoop = true;
-    }
-    output += "]]\n";
-
-    if (utils->hasMarkedDeclarations()) {
-      llvm::raw_fd_ostream *fileOutput = new llvm::raw_fd_ostream(
-          utils->getDestinationDirectory() + outputFileName, Err,
-          llvm::sys::fs::F_RW);
-      if (Err) {
-        llvm::errs() << "Error creating file \"" << outputFileName
-                     << "\" : " << Err.message() << "!\n";
-        return;
-      }
-      (*fileOutput) << output;
-      (*fileOutput).close();
-      delete fileOutput;
-    }
-    delete utils;
-  }
-
-private:
-  FunctionVisitor FunctionsVisitor;
-  RecordVisitor RecordsVisitor;
-  EnumVisitor EnumsVisitor;
-  TypedefVisitor TypedefsVisitor;
-  std::string output;
-  FFIBindingsUtils *utils;
-
-  /**
-   * Determine whether this declaration depends on itself (directly or
-   * indirectly).
-   */
-  bool DependsOnItself(std::string DeclName,
-                       std::vector<std::string> *dependencyList) {
-    // Direct and indirect dependencies of this declaration
-    std::stack<std::string> Dependencies;
-    // Declarations that have already been checked
-    std::set<std::string> CheckedDecls;
-
-    for (std::vector<std::string>::iterator dependency =
-             dependencyList->begin();
-         dependency != dependencyList->end(); ++dependency) {
-      if (utils->isInUnresolvedDeclarations(*dependency)) {
-        Dependencies.push(*dependency);
-        CheckedDecls.insert(*dependency);
-      }
-    }
-    while (Dependencies.size()) {
-      std::string DeclToCheck = Dependencies.top();
-      Dependencies.pop();
-      if (DeclToCheck == DeclName)
-        return true;
-      DeclarationInfo depDecl =
-          utils->getUnresolvedDeclarations()->at(DeclToCheck);
-      if (!utils->isInResolvedDecls(DeclToCheck) &&
-          !DependsOnItselfDirectly(DeclToCheck, depDecl.dependencyList)) {
-        for (std::vector<std::string>::iterator dependency =
-                 depDecl.dependencyList->begin();
-             dependency != depDecl.dependencyList->end(); ++dependency) {
-          if (utils->isInUnresolvedDeclarations(*dependency) &&
-              (CheckedDecls.find(*dependency) == CheckedDecls.end())) {
-            Dependencies.push(*dependency);
-            CheckedDecls.insert(*dependency);
-          }
-        }
-      }
-    }
-    return false;
-  }
-
-  /**
-   * Determine whether this declaration depends on itself directly.
-   */
-  bool DependsOnItselfDirectly(std::string DeclName,
-                               std::vector<std::string> *dependencyList) {
-    for (std::vector<std::string>::iterator dependency =
-             dependencyList->begin();
-         dependency != dependencyList->end(); ++dependency) {
-      if (*dependency == DeclName)
-        return true;
-    }
-    return false;
-  }
-};
+#include "clang/Lex/Preprocessor.h"
 
 class GenerateFFIBindingsAction : public PluginASTAction {
 protected:
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  llvm::StringRef inputFile) {
 
-    FFIBindingsUtils *utils = FFIBindingsUtils::getInstance();
+    // the output file name is derived from the name of each input file
+    FFIBindingsOptions consumerOptions = options;
 
-    if (utils->getOutputFileName() == "") {
+    if (consumerOptions.outputFileName == "") {
       std::string filename = inputFile;
       char separator;
 #ifdef LLVM_ON_UNIX
@@ -321,15 +39,24 @@ protected:
       filename.replace(filename.find_first_of('.'),
                        filename.length() - filename.find_first_of('.'), "");
       filename += "_gen_ffi.lua";
-      utils->setOutputFileName(filename);
+      consumerOptions.outputFileName = filename;
+    }
+    std::unique_ptr<GenerateFFIBindingsConsumer> Consumer =
+        llvm::make_unique<GenerateFFIBindingsConsumer>(
+            consumerOptions, CI.getPreprocessor().getPredefines());
+    if (consumerOptions.isMacrosMode) {
+      std::unique_ptr<MacroConstantCollector> MacroConstants =
+          llvm::make_unique<MacroConstantCollector>(CI.getPreprocessor());
+      Consumer->setMacroConstants(MacroConstants.get());
+      CI.getPreprocessor().addPPCallbacks(std::move(MacroConstants));
     }
-    return llvm::make_unique<GenerateFFIBindingsConsumer>();
+    return std::move(Consumer);
   }
 
   bool ParseArgs(const CompilerInstance &CI,
                  const std::vector<std::string> &args) {
 
-    FFIBindingsUtils *utils = FFIBindingsUtils::getInstance();
+    options.pluginArguments = args;
 
     for (unsigned i = 0, e = args.size(); i != e; ++i) {
 
@@ -339,30 +66,98 @@ protected:
       }
 
       if (args[i] == "test")
-        utils->setTestingMode(true);
+        options.isTestingMode = true;
+
+      if (args[i] == "-time")
+        options.printTimeReport = true;
+
+      if (args[i] == "-compact")
+        options.isCompactMode = true;
+
+      if (args[i] == "-lazy")
+        options.isLazyMode = true;
+
+      if (args[i] == "-ctypes")
+        options.isCTypesMode = true;
+
+      if (args[i] == "-layout")
+        options.isLayoutMode = true;
+
+      if (args[i] == "-index")
+        options.isIndexMode = true;
+
+      if (args[i] == "-macros")
+        options.isMacrosMode = true;
+
+      if (args[i] == "-shim") {
+        if (args.size() >= i + 2)
+          options.shimFileName = args[i + 1];
+        else
+          llvm::outs() << "Enter name of the shim file.\n";
+      }
+
+      if (args[i] == "-shim-macros") {
+        if (args.size() >= i + 2)
+          options.shimMacrosFileName = args[i + 1];
+        else
+          llvm::outs() << "Enter name of the file containing macro "
+                          "prototypes.\n";
+      }
+
+      if (args[i] == "-export-all")
+        options.isExportAllMode = true;
+
+      if (args[i] == "-export-header") {
+        if (args.size() >= i + 2) {
+          options.exportHeaders.push_back(args[i + 1]);
+          options.isExportAllMode = true;
+        } else
+          llvm::outs() << "Enter name of the header to export.\n";
+      }
+
+      if (args[i] == "-stats") {
+        if (args.size() >= i + 2)
+          options.statsFileName = args[i + 1];
+        else
+          llvm::outs() << "Enter name of the statistics file.\n";
+      }
+
+      if (args[i] == "-depfile") {
+        if (args.size() >= i + 2)
+          options.depFileName = args[i + 1];
+        else
+          llvm::outs() << "Enter name of the dependency file.\n";
+      }
 
       if (args[i] == "-output") {
         if (args.size() >= i + 2)
-          utils->setOutputFileName(args[i + 1]);
+          options.outputFileName = args[i + 1];
         else
           llvm::outs() << "Enter output file name.\n";
       }
 
       if (args[i] == "-header") {
         if (args.size() >= i + 2)
-          utils->setHeaderFileName(args[i + 1]);
+          options.headerFileName = args[i + 1];
         else
           llvm::outs() << "Enter header file name.\n";
       }
 
       if (args[i] == "-blacklist") {
         if (args.size() >= i + 2)
-          utils->setBlacklistFileName(args[i + 1]);
+          options.blacklistFileName = args[i + 1];
         else
           llvm::outs()
               << "Enter name of the file containing type blacklist. \n";
       }
 
+      if (args[i] == "-filters") {
+        if (args.size() >= i + 2)
+          options.filtersFileName = args[i + 1];
+        else
+          llvm::outs() << "Enter name of the file containing filters.\n";
+      }
+
       if (args[i] == "-destdir") {
         if (args.size() >= i + 2) {
           char separator;
@@ -377,10 +172,29 @@ protected:
             if (destDir[end] != separator)
               destDir += separator;
           }
-          utils->setDestinationDirectory(destDir);
+          options.destinationDirectory = destDir;
         } else
           llvm::outs() << "Enter path of the destination directory.\n";
       }
+
+      if (args[i] == "-cachedir") {
+        if (args.size() >= i + 2) {
+          char separator;
+#ifdef LLVM_ON_UNIX
+          separator = '/';
+#else
+          separator = '\\';
+#endif
+          std::string cacheDir = args[i + 1];
+          if (cacheDir.size() > 0) {
+            int end = cacheDir.size() - 1;
+            if (cacheDir[end] != separator)
+              cacheDir += separator;
+          }
+          options.cacheDirectory = cacheDir;
+        } else
+          llvm::outs() << "Enter path of the cache directory.\n";
+      }
     }
     return true;
   }
@@ -396,8 +210,79 @@ protected:
            "the generated file.\n";
     ros << "  -blacklist    Specifies text file that contains list of types "
            "that should not be emitted or resolved.\n";
+    ros << "  -filters    Specifies text file with include and exclude "
+           "patterns, one per line in the form \"include|exclude "
+           "name|namespace|file <pattern>\" (e.g. \"exclude file "
+           "/usr/include/*\"). Patterns are globs, or regular expressions "
+           "when written between slashes. Names are spelled as on the "
+           "blacklist. Declarations that match an exclude pattern and no "
+           "include pattern are treated as blacklisted.\n";
     ros << "  -destdir    Specifies path to the destination directory. This is "
            "the directory where output Lua file will be generated.\n";
+    ros << "  -cachedir    Specifies path to the cache directory. Generated "
+           "files are stored there and reused when the source file and all "
+           "the files it includes are unchanged.\n";
+    ros << "  -depfile    Specifies file that the list of files the output "
+           "depends on (files that declarations come from, the header and "
+           "the blacklist file) is written to, as a Makefile rule. Output "
+           "files whose contents don't change are not rewritten.\n";
+    ros << "  -time    Prints out the time spent in each phase of generating "
+           "the bindings.\n";
+    ros << "  -stats    Specifies file that statistics (the number of "
+           "declarations found, resolved, etc. and the time spent in each "
+           "phase) are written to in JSON format.\n";
+    ros << "  -compact    Generates bindings that take less time for LuaJIT "
+           "to parse: declarations are written on a single line each, "
+           "typedefs of typedefs refer to the type at the end of the chain "
+           "and records that are only pointed to by declarations the marked "
+           "ones depend on are left incomplete.\n";
+    ros << "  -lazy    Generates a module that declares a symbol, and the "
+           "symbols it depends on, the first time it is accessed (e.g. "
+           "\"bindings.foo\" for function foo, or \"bindings[\"struct "
+           "bar\"]\" for its ctype), instead of declaring everything when it "
+           "is loaded.\n";
+    ros << "  -ctypes    Generates a table of ctypes (ffi.typeof()) of the "
+           "emitted records and typedefs, and of variable length arrays of "
+           "them (e.g. \"struct foo[?]\"), which is returned by the "
+           "generated module. A lazy module provides them by itself.\n";
+    ros << "  -layout    Writes the size, alignment and field offsets of the "
+           "emitted records, as computed by clang, to a Lua module named "
+           "after the output file (e.g. \"test_layout.lua\" for "
+           "\"test.lua\"). The module contains a self-test that compares "
+           "them with LuaJIT's, and a report of padding and of fields that "
+           "straddle cache lines. The cache is not used with this option.\n";
+    ros << "  -index    Writes an index of the emitted declarations next to "
+           "the output file (e.g. \"test.idx.jsonl\" for \"test.lua\"), "
+           "with a JSON object per line that contains the name, kind, hash, "
+           "source location and dependencies of a declaration, in the order "
+           "they are written.\n";
+    ros << "  -macros    Writes the integer constants defined with #define "
+           "in the files that contain marked declarations (e.g. \"#define "
+           "FOO (1 << 4)\") to the ffi.cdef block, as \"static const int "
+           "FOO = 16;\", so LuaJIT can use them as compile-time "
+           "constants (e.g. \"ffi.C.FOO\").\n";
+    ros << "  -shim    Specifies C file (generated in the destination "
+           "directory) that exported wrappers are written to, for marked "
+           "functions that LuaJIT can't call (static and static inline "
+           "functions) and for variants of functions that take or return "
+           "records by value, which take pointers instead (e.g. "
+           "\"foo_ptr(&result, &a)\" for \"result = foo(a)\"). The "
+           "bindings refer to the wrappers, so the file has to be compiled "
+           "into the library the bindings are used with. Only functions "
+           "declared in headers are wrapped, as the shim includes the "
+           "files that declare them.\n";
+    ros << "  -shim-macros    Specifies text file with prototypes of "
+           "function-like macros to write wrappers of with -shim (e.g. "
+           "\"int MAX(int a, int b);\"). Lines starting with '#' (e.g. the "
+           "includes that define the macros) are copied to the shim.\n";
+    ros << "  -export-all    Generates bindings for every function, record, "
+           "enum and typedef declared in the source file, whether it was "
+           "marked with the ffibinding attribute or not. Unlike test mode, "
+           "declarations from included files are only bound if the marked "
+           "or exported ones depend on them.\n";
+    ros << "  -export-header    Specifies a header whose declarations are "
+           "exported too (implies -export-all). Can be given more than "
+           "once.\n";
     ros << "   test      Turns on test mode. When in test mode,\n"
            "             the plugin generates bindings for each function,\n"
            "             whether it was marked with the ffibinding attribute "
@@ -429,6 +314,9 @@ protected:
            "\"blacklist.txt\" "
            "file.\n\n";
   }
+
+private:
+  FFIBindingsOptions options;
 };
 
 static FrontendPluginRegistry::Add<GenerateFFIBindingsAction>
@@ -7,11 +7,31 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "llvm/Support/raw_ostream.h"
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/Timer.h"
 #include <fstream>
+#include <queue>
 using namespace clang;
 
 namespace constants {
 const std::string SRC_FILE_PLACE_HOLDER = "<source-files>";
+/** Part of every cache key; needs to be changed whenever the output for the
+ * same input changes. */
+const std::string CACHE_FORMAT_VERSION = "ffi-gen-5";
+/** Stands for the declarator in memoized results of checkType(). */
+const std::string DECLARATOR_PLACE_HOLDER = "\x01";
+/** Number of table entries put in a single generated Lua function (the
+ * number of constants of a function is limited). */
+const unsigned LUA_ENTRIES_PER_FUNCTION = 1000;
+/** Size of a cache line in bytes, for the report of the -layout option. */
+const unsigned CACHE_LINE_SIZE = 64;
 }
 
 /**
@@ -19,25 +39,213 @@ const std::string SRC_FILE_PLACE_HOLDER = "<source-files>";
  *additional information.
  **/
 struct TypeDeclaration {
-  std::string TypeName;
+  /** ID of the declaration (see FFIBindingsUtils::getDeclID()). */
+  unsigned ID;
   /** Declaration node. The information that it contains depends on the type of
    * the declaration (function, struct, enum, etc.). */
   TypeDecl *Declaration;
 };
 
+/**
+ * Result of checking a type (see FFIBindingsUtils::checkType()), reused
+ * whenever the same type is checked again.
+ **/
+struct CheckTypeResult {
+  /** Printed type, with constants::DECLARATOR_PLACE_HOLDER in place of the
+   * declarator. */
+  std::string Declaration;
+  /** Declarations the type depends on, in the order they were found.
+   * Blacklisted declarations (which are only marked as resolved) have no
+   * Declaration. */
+  std::vector<TypeDeclaration> Dependencies;
+};
+
 /**
  * Information about a declaration needed for it to be resolved and
  * printed in the right order (after declarations that it depends on).
  *
  **/
 struct DeclarationInfo {
-  /** Full declaration (this is what will be printed). */
-  std::string Declaration;
+  /** Full declaration (this is what will be printed). Allocated in the
+   * arena of FFIBindingsUtils. */
+  StringRef Declaration;
   /** Is the declaration already resolved. */
   bool isResolved = true;
   /** A list of declarations this declaration depends on (these declarations
-   * need to be printed out before it). */
-  std::vector<std::string> *dependencyList;
+   * need to be printed out before it), as declaration IDs. Allocated in the
+   * arena of FFIBindingsUtils. */
+  ArrayRef<unsigned> dependencyList;
+};
+
+/**
+ * A declaration as it was written to the output, for the index written with
+ * the -index option.
+ **/
+struct IndexEntry {
+  unsigned ID;
+  /** Is this the forward declaration of a record. */
+  bool isForwardDeclaration;
+  /** MD5 of the text of the declaration as it was written. */
+  std::string Hash;
+  /** Declarations it depends on, as declaration IDs. */
+  std::vector<unsigned> Dependencies;
+  /** Key of the entry, if it isn't the name of the declaration (the pointer
+   * variant of a function). */
+  std::string Name;
+};
+
+class FFIBindingsUtils;
+
+/**
+ * Options that affect the generated output, set from the command line.
+ **/
+struct FFIBindingsOptions {
+  std::string outputFileName = "";
+  std::string headerFileName = "";
+  std::string blacklistFileName = "";
+  std::string destinationDirectory = "";
+  std::string cacheDirectory = "";
+  /** Arguments passed to the plugin (used as a part of the cache key). */
+  std::vector<std::string> pluginArguments;
+  /** This flag is set to true when 'test' is passed on the command line. */
+  bool isTestingMode = false;
+  /** Print out the time spent in each phase (-time). */
+  bool printTimeReport = false;
+  /** File statistics are written to (-stats). */
+  std::string statsFileName = "";
+  /** Makefile-style file that lists the files the output depends on
+   * (-depfile). */
+  std::string depFileName = "";
+  /** Emit the bindings with as little text for LuaJIT to parse as possible
+   * (-compact). */
+  bool isCompactMode = false;
+  /** Generate a module that declares a symbol (and what it depends on) only
+   * when it is first used (-lazy). */
+  bool isLazyMode = false;
+  /** Generate a table of ctypes of the emitted records and typedefs after
+   * the ffi.cdef block (-ctypes). */
+  bool isCTypesMode = false;
+  /** Write the layout of the emitted records to a separate file (-layout). */
+  bool isLayoutMode = false;
+  /** Write an index of the emitted declarations next to the output
+   * (-index). */
+  bool isIndexMode = false;
+  /** File with include and exclude patterns for declarations (-filters). */
+  std::string filtersFileName = "";
+  /** Bind every declaration in the main file and in exportHeaders, whether
+   * it is marked with the ffibinding attribute or not (-export-all). */
+  bool isExportAllMode = false;
+  /** Headers whose declarations are bound in export-all mode, in addition to
+   * the ones in the main file (-export-header). */
+  std::vector<std::string> exportHeaders;
+  /** Write integer constants defined with #define in files that contain
+   * marked declarations to the ffi.cdef block (-macros). */
+  bool isMacrosMode = false;
+  /** C file that exported wrappers of functions LuaJIT can't call directly
+   * are written to (-shim). */
+  std::string shimFileName = "";
+  /** File with prototypes of function-like macros to write wrappers of
+   * (-shim-macros). */
+  std::string shimMacrosFileName = "";
+};
+
+/**
+ * Counters and phase timers of a single translation unit, reported with the
+ * -time and -stats options. Nothing is measured unless they are enabled.
+ **/
+class FFIBindingsStats {
+public:
+  enum Phase {
+    /** Collecting marked declarations while parsing (or traversing). */
+    COLLECT,
+    /** Resolving marked declarations. */
+    RESOLVE,
+    /** Resolving declarations that marked declarations depend on. */
+    FIND,
+    /** Ordering and printing out unresolved declarations. */
+    EMIT,
+    /** Writing the header and committing the output file. */
+    WRITE,
+    /** Time spent in checkType() (part of RESOLVE and FIND). */
+    CHECK_TYPE,
+    NUM_PHASES
+  };
+  enum Counter {
+    DECLS_VISITED,
+    DECLS_MARKED,
+    RESOLVED_DIRECTLY,
+    DEFERRED,
+    FORWARD_DECLARED,
+    DROPPED,
+    CHECK_TYPE_CALLS,
+    CHECK_TYPE_MEMO_HITS,
+    BYTES_EMITTED,
+    DECL_IDS,
+    PEAK_DECLS_TO_FIND,
+    PEAK_UNRESOLVED_DECLS,
+    NUM_COUNTERS
+  };
+
+  FFIBindingsStats() : enabled(false) {
+    for (unsigned i = 0; i < NUM_COUNTERS; i++)
+      Counters[i] = 0;
+    for (unsigned i = 0; i < NUM_PHASES; i++)
+      Depth[i] = 0;
+  }
+
+  bool isEnabled() { return enabled; }
+
+  void setEnabled(bool enabled_) { enabled = enabled_; }
+
+  void increment(Counter C, uint64_t N = 1) {
+    if (enabled)
+      Counters[C] += N;
+  }
+
+  void updatePeak(Counter C, uint64_t Value) {
+    if (enabled && Value > Counters[C])
+      Counters[C] = Value;
+  }
+
+  /** Starts measuring the given phase. Phases can be nested in themselves
+   * (e.g. recursive calls), only the outermost one is measured. */
+  void startPhase(Phase P);
+  void stopPhase(Phase P);
+  /** Prints out the time spent in each phase. */
+  void printTimeReport(llvm::raw_ostream &OS);
+  /** Prints out the counters and the phase times as a JSON object. */
+  void printJSON(llvm::raw_ostream &OS, StringRef SourceFileName);
+
+private:
+  bool enabled;
+  uint64_t Counters[NUM_COUNTERS];
+  llvm::TimeRecord Times[NUM_PHASES];
+  llvm::TimeRecord Started[NUM_PHASES];
+  unsigned Depth[NUM_PHASES];
+};
+
+/** Writes the string as the contents of a JSON string literal (without the
+ * quotes). UTF-8 is written as it is. */
+void writeJSONString(llvm::raw_ostream &OS, StringRef S);
+
+/**
+ * Measures the time spent in a phase while it is in scope.
+ **/
+class PhaseTimer {
+public:
+  PhaseTimer(FFIBindingsStats *stats_, FFIBindingsStats::Phase phase_)
+      : stats(stats_), phase(phase_) {
+    if (stats->isEnabled())
+      stats->startPhase(phase);
+  }
+  ~PhaseTimer() {
+    if (stats->isEnabled())
+      stats->stopPhase(phase);
+  }
+
+private:
+  FFIBindingsStats *stats;
+  FFIBindingsStats::Phase phase;
 };
 
 /**
@@ -46,9 +254,12 @@ struct DeclarationInfo {
  **/
 class FunctionVisitor : public RecursiveASTVisitor<FunctionVisitor> {
 public:
-  FunctionVisitor() {}
+  FunctionVisitor(FFIBindingsUtils *utils_) : utils(utils_) {}
   /** Visits function declarations in a parsed AST. */
   bool VisitFunctionDecl(FunctionDecl *FD);
+
+private:
+  FFIBindingsUtils *utils;
 };
 
 /**
@@ -57,9 +268,12 @@ public:
  **/
 class RecordVisitor : public RecursiveASTVisitor<RecordVisitor> {
 public:
-  RecordVisitor() {}
+  RecordVisitor(FFIBindingsUtils *utils_) : utils(utils_) {}
   /** Visits record declarations in a parsed AST. */
   bool VisitRecordDecl(RecordDecl *RD);
+
+private:
+  FFIBindingsUtils *utils;
 };
 
 /**
@@ -67,9 +281,12 @@ public:
  **/
 class EnumVisitor : public RecursiveASTVisitor<EnumVisitor> {
 public:
-  EnumVisitor() {}
+  EnumVisitor(FFIBindingsUtils *utils_) : utils(utils_) {}
   /** Visits enum declarations in a parsed AST. */
   bool VisitEnumDecl(EnumDecl *ED);
+
+private:
+  FFIBindingsUtils *utils;
 };
 
 /**
@@ -78,9 +295,166 @@ public:
  **/
 class TypedefVisitor : public RecursiveASTVisitor<TypedefVisitor> {
 public:
-  TypedefVisitor() {}
+  TypedefVisitor(FFIBindingsUtils *utils_) : utils(utils_) {}
   /** Visits typedef declarations in a parsed AST. */
   bool VisitTypedefDecl(TypedefNameDecl *TD);
+
+private:
+  FFIBindingsUtils *utils;
+};
+
+/**
+ * Collects the declarations that need to be resolved, either while the
+ * translation unit is being parsed (see collectTopLevelDecl() and
+ * collectTagDefinition()) or in a single traversal of the parsed AST, so that
+ * the translation unit doesn't have to be walked once per declaration kind.
+ * Collected declarations are kept in the order they were found.
+ **/
+class MarkedDeclVisitor : public RecursiveASTVisitor<MarkedDeclVisitor> {
+public:
+  MarkedDeclVisitor(FFIBindingsUtils *utils_) : utils(utils_) {}
+  /** Collects given top-level declaration. Only linkage specifications and
+   * namespaces are looked into; tag definitions, wherever they are, are
+   * collected by collectTagDefinition(). */
+  void collectTopLevelDecl(Decl *D);
+  /** Collects given record or enum definition. */
+  void collectTagDefinition(TagDecl *TD);
+  /** Returns true if no declarations have been collected. */
+  bool empty() {
+    return Functions.empty() && Records.empty() && Enums.empty() &&
+           Typedefs.empty();
+  }
+  /** Forgets all collected declarations. */
+  void clear() {
+    Functions.clear();
+    Records.clear();
+    Enums.clear();
+    Typedefs.clear();
+  }
+  /** Collects function declarations (all of them when in test mode). */
+  bool VisitFunctionDecl(FunctionDecl *FD);
+  /** Collects record declarations marked with the ffibinding attribute. */
+  bool VisitRecordDecl(RecordDecl *RD);
+  /** Collects enum declarations marked with the ffibinding attribute. */
+  bool VisitEnumDecl(EnumDecl *ED);
+  /** Collects typedef declarations marked with the ffibinding attribute. */
+  bool VisitTypedefDecl(TypedefNameDecl *TD);
+
+  std::vector<FunctionDecl *> &getFunctions() { return Functions; }
+
+  std::vector<RecordDecl *> &getRecords() { return Records; }
+
+  std::vector<EnumDecl *> &getEnums() { return Enums; }
+
+  std::vector<TypedefNameDecl *> &getTypedefs() { return Typedefs; }
+
+private:
+  FFIBindingsUtils *utils;
+  std::vector<FunctionDecl *> Functions;
+  std::vector<RecordDecl *> Records;
+  std::vector<EnumDecl *> Enums;
+  std::vector<TypedefNameDecl *> Typedefs;
+};
+
+/**
+ * Include and exclude patterns that declarations are matched against, read
+ * from the file given with the -filters option. Each line of the file is
+ * "include|exclude name|namespace|file <pattern>", where the pattern is a
+ * glob, or a regular expression if it is written between slashes; lines
+ * starting with '#' are comments. A declaration is excluded if its name, its
+ * enclosing namespace or the file it comes from matches an exclude pattern
+ * and none of them matches an include pattern. Excluded declarations are
+ * treated as if they were on the blacklist.
+ **/
+class DeclarationFilter {
+public:
+  /** Reads the patterns from given file. Returns false, and sets Error, if
+   * the file can't be read or contains an invalid pattern. */
+  bool load(const std::string &FileName, std::string &Error);
+  /** Returns true if no patterns have been loaded. */
+  bool empty() { return isEmpty; }
+  /** Returns true if the declaration with given name, enclosing namespace
+   * ("" if none) and file (NULL if unknown) is excluded. */
+  bool isExcluded(StringRef Name, StringRef Namespace, const FileEntry *File);
+
+private:
+  enum Action { INCLUDE, EXCLUDE, NUM_ACTIONS };
+  enum Kind { DECL_NAME, NAMESPACE_NAME, FILE_NAME, NUM_KINDS };
+
+  bool isEmpty = true;
+  /** Patterns of each action and kind, joined into a single expression. */
+  std::unique_ptr<llvm::Regex> Matchers[NUM_ACTIONS][NUM_KINDS];
+  /** Whether each file matches the include and the exclude patterns. */
+  llvm::DenseMap<const FileEntry *, std::pair<bool, bool>> FileMatches;
+};
+
+/**
+ * Prototype of a function-like macro that a wrapper is written for, as
+ * given in the -shim-macros file (e.g. "int MAX(int a, int b);").
+ **/
+struct MacroPrototype {
+  std::string Name;
+  std::string ReturnType;
+  /** Text between the parentheses of the prototype. */
+  std::string ParameterList;
+  /** Names of the parameters, the arguments of the macro. */
+  std::vector<std::string> Parameters;
+};
+
+/**
+ * C source file written with the -shim option, with exported wrappers of the
+ * functions that LuaJIT can't call, or can only call slowly: functions with
+ * internal linkage (e.g. static inline functions in headers), function-like
+ * macros listed in the -shim-macros file, and functions that take or return
+ * records by value, whose wrappers pass them through pointers instead. The
+ * bindings redirect the original names to the wrappers (with __asm__), so
+ * the shim has to be compiled into the library the bindings are used with.
+ **/
+class ShimWriter {
+public:
+  /** Returns true if given function can only be called through a
+   * wrapper. */
+  static bool needsWrapper(FunctionDecl *FD);
+  /** Returns true if given function takes or returns a record by value. */
+  static bool hasRecordByValue(FunctionDecl *FD);
+  /** Returns true if given function is declared in a file the shim can
+   * include: a header, not the main file (the functions it defines would be
+   * defined again by the shim). */
+  static bool canBeWrapped(FunctionDecl *FD);
+  /** Returns the name of the wrapper of given function or macro. */
+  static std::string getWrapperName(StringRef Name) {
+    return "ffi_shim_" + Name.str();
+  }
+  /** Returns the name under which the variant of given function that takes
+   * records through pointers is bound. */
+  static std::string getPointerVariantName(StringRef Name) {
+    return Name.str() + "_ptr";
+  }
+  /** Reads the prototypes of function-like macros from given file, where
+   * lines starting with '#' (e.g. includes) are copied to the shim. Returns
+   * false, and sets Error, if the file can't be read or parsed. */
+  bool loadMacros(const std::string &FileName, std::string &Error);
+  const std::vector<MacroPrototype> &getMacros() { return Macros; }
+  /** Adds a wrapper that calls given function with the same arguments. */
+  void addWrapper(FunctionDecl *FD);
+  /** Adds a wrapper that takes pointers to the records given function takes
+   * by value, and stores a record it returns to its first argument. */
+  void addPointerWrapper(FunctionDecl *FD);
+  /** Returns true if no wrappers have been added. */
+  bool empty() { return Wrappers.empty() && Macros.empty(); }
+  /** Writes the C source file. */
+  void write(llvm::raw_ostream &OS);
+
+private:
+  /** Files that declare the wrapped functions, included by the shim. */
+  llvm::SetVector<const FileEntry *> Includes;
+  /** Preprocessor directives from the -shim-macros file. */
+  std::string Preamble;
+  std::vector<MacroPrototype> Macros;
+  /** Definitions of the function wrappers. */
+  std::string Wrappers;
+
+  void addInclude(FunctionDecl *FD);
 };
 
 class FFIBindingsUtils {
@@ -101,20 +475,44 @@ public:
     NORMAL
   };
 
-  static FFIBindingsUtils *getInstance();
-  /** Is this the first time to come across given declaration type.
-   *  Returns false if the type is already resolved, waiting to be resolved or
-   * printed out, true otherwise. */
-  bool isNewType(QualType Type);
-  /** Returns true if given declaration type is in the UnresolvedDeclarations
+  /** Creates the resolution state of a single translation unit. Nothing is
+   * shared between instances, so translation units can be processed in
+   * parallel threads. */
+  FFIBindingsUtils(const FFIBindingsOptions &options_) : options(options_) {
+    stats.setEnabled(options.printTimeReport || options.statsFileName != "");
+    CheckTypeDependencies = NULL;
+    UnresolvedDeclarations = new llvm::MapVector<unsigned, DeclarationInfo>();
+    DeclsToFind = new std::stack<TypeDeclaration>();
+    blacklist = new std::set<std::string>();
+  }
+  /** Returns a dense integer ID for the given declaration. All redeclarations
+   * of an entity share the same ID, which is used as the key of the
+   * declaration in all lookups. */
+  unsigned getDeclID(Decl *D);
+  /** Returns the declaration with given ID. */
+  Decl *getDecl(unsigned ID) { return Decls[ID]; }
+  /** Returns the name of the declaration with given ID as it is printed out
+   * (e.g. "struct foo", "enum bar" or "foo_t"). */
+  std::string getDeclName(unsigned ID);
+  /** Is this the first time to come across given declaration.
+   *  Returns false if the declaration is already resolved, waiting to be
+   * resolved or printed out, true otherwise. */
+  bool isNewType(unsigned ID);
+  /** Returns true if given declaration is in the UnresolvedDeclarations
    * list, false otherwise. */
-  bool isInUnresolvedDeclarations(std::string DeclType);
-  /** Returns true if given declaration type is in the ResolvedDecls
+  bool isInUnresolvedDeclarations(unsigned ID);
+  /** Returns true if given declaration is in the ResolvedDecls
    * list, false otherwise. */
-  bool isInResolvedDecls(std::string DeclType);
-  /** Returns true if this type should not be resolved and emitted because it is
-   * on the blacklist, false otherwise. */
-  bool isOnBlacklist(std::string DeclType);
+  bool isInResolvedDecls(unsigned ID);
+  /** Marks given declaration as resolved (printed out or not to be printed
+   * out). */
+  void addToResolvedDecls(unsigned ID);
+  /** Returns true if this declaration should not be resolved and emitted
+   * because it is on the blacklist, false otherwise. */
+  bool isOnBlacklist(unsigned ID);
+  /** Returns the name used for the given anonymous record in the output (e.g.
+   * "Anonymous_test_c_120" for a record at offset 120 of "test.c"). */
+  std::string getAnonRecordName(RecordDecl *RD);
   /** Get size of the array (e.g. for "double arr[6]" return value would be
    * "[6]"). */
   std::string getArraySize(const ConstantArrayType *CAT);
@@ -122,48 +520,87 @@ public:
    * Decl.*/
   std::string getDeclAttrs(Decl *RD);
 
-  std::map<std::string, DeclarationInfo> *getUnresolvedDeclarations() {
+  /** Adds a declaration that can't be printed out until the declarations it
+   * depends on are. The text and the dependencies are copied to the arena. */
+  void addToUnresolvedDeclarations(unsigned ID, StringRef Declaration,
+                                   ArrayRef<unsigned> Dependencies);
+
+  llvm::MapVector<unsigned, DeclarationInfo> *getUnresolvedDeclarations() {
     return UnresolvedDeclarations;
   }
 
   std::stack<TypeDeclaration> *getDeclsToFind() { return DeclsToFind; }
 
-  std::set<std::string> *getResolvedDecls() { return ResolvedDecls; }
+  std::string getOutputFileName() { return options.outputFileName; }
 
-  std::string getOutputFileName() { return outputFileName; }
+  std::string getHeaderFileName() { return options.headerFileName; }
 
-  void setOutputFileName(std::string filename) { outputFileName = filename; }
+  std::string getBlacklistFileName() { return options.blacklistFileName; }
 
-  std::string getHeaderFileName() { return headerFileName; }
+  std::string getDestinationDirectory() {
+    return options.destinationDirectory;
+  }
 
-  void setHeaderFileName(std::string filename) { headerFileName = filename; }
+  std::set<std::string> *getBlacklist() { return blacklist; }
 
-  std::string getBlacklistFileName() { return blacklistFileName; }
+  std::string getFiltersFileName() { return options.filtersFileName; }
 
-  void setBlacklistFileName(std::string filename) {
-    blacklistFileName = filename;
-  }
+  DeclarationFilter *getFilter() { return &Filter; }
 
-  std::string getDestinationDirectory() { return destinationDirectory; }
+  std::string getCacheDirectory() { return options.cacheDirectory; }
 
-  void setDestinationDirectory(std::string destDir) {
-    destinationDirectory = destDir;
+  std::vector<std::string> &getPluginArguments() {
+    return options.pluginArguments;
   }
 
-  std::set<std::string> *getBlacklist() { return blacklist; }
+  bool isTestingModeOn() { return options.isTestingMode; }
+
+  bool isTimeReportOn() { return options.printTimeReport; }
+
+  std::string getStatsFileName() { return options.statsFileName; }
+
+  bool isCompactModeOn() { return options.isCompactMode; }
+
+  std::string getDepFileName() { return options.depFileName; }
+
+  /** Returns the names of the files that contain the declarations written
+   * so far (only with -depfile). */
+  std::vector<std::string> getContributingFiles();
+
+  bool isLazyModeOn() { return options.isLazyMode; }
+
+  bool isCTypesModeOn() { return options.isCTypesMode; }
+
+  bool isLayoutModeOn() { return options.isLayoutMode; }
+
+  bool isIndexModeOn() { return options.isIndexMode; }
 
-  bool isTestingModeOn() { return isTestingMode; }
+  bool isExportAllModeOn() { return options.isExportAllMode; }
 
-  void setTestingMode(bool testingMode) { isTestingMode = testingMode; }
+  bool isMacrosModeOn() { return options.isMacrosMode; }
 
-  std::vector<std::string> *getAnonymousRecords() { return AnonymousRecords; }
+  bool isShimModeOn() { return options.shimFileName != ""; }
+
+  std::string getShimFileName() { return options.shimFileName; }
+
+  std::string getShimMacrosFileName() { return options.shimMacrosFileName; }
+
+  ShimWriter *getShim() { return &Shim; }
+
+  /** Returns true if given declaration is to be bound: it is marked with the
+   * ffibinding attribute or, in export-all mode, it is spelled in the main
+   * file or in one of the exported headers. */
+  bool isMarked(Decl *D);
+
+  FFIBindingsStats *getStats() { return &stats; }
+
+  /** Returns the number of declarations that have been given an ID. */
+  unsigned getNumDeclIDs() { return Decls.size(); }
 
   ~FFIBindingsUtils() {
     delete UnresolvedDeclarations;
     delete DeclsToFind;
-    delete ResolvedDecls;
     delete blacklist;
-    delete AnonymousRecords;
   }
 
   bool hasMarkedDeclarations() { return markedDeclarations; }
@@ -172,10 +609,48 @@ public:
     markedDeclarations = markedDeclarations_;
   }
 
-  void setOutput(std::string *output_) { output = output_; }
+  void setOutput(llvm::raw_ostream *output_) { output = output_; }
 
   void setContext(ASTContext *astContext) { Context = astContext; }
 
+  /** Prints out a declaration that has been resolved immediately. */
+  void printDeclaration(unsigned ID, const std::string &Declaration);
+  /** Writes the declaration with given ID and the line break after it to the
+   * given stream. In compact mode line breaks within the declaration are
+   * removed and declarations aren't separated by empty lines. In lazy mode
+   * the declaration is written as an entry of the loader's table, together
+   * with the names of the declarations it depends on. */
+  void writeDeclaration(llvm::raw_ostream &OS, unsigned ID,
+                        StringRef Declaration,
+                        ArrayRef<unsigned> Dependencies = ArrayRef<unsigned>());
+  /** Writes a declaration that comes from a macro, so it has no declaration
+   * node: a constant (e.g. "static const int FOO = 1;") or the wrapper of a
+   * function-like macro. Kind is the kind of its lazy entry ("constant" or
+   * "function"). */
+  void writeMacroDeclaration(llvm::raw_ostream &OS, StringRef Name,
+                             StringRef Kind, StringRef Declaration);
+  /** Writes a forward declaration of the record with given ID (in lazy mode,
+   * it is only recorded and written with the record). */
+  void writeForwardDeclaration(llvm::raw_ostream &OS, unsigned ID);
+  /** Writes the table of ctypes of the records and typedefs written so far,
+   * and of variable length arrays of them, and returns it from the module
+   * (e.g. ctypes["struct foo"] and ctypes["struct foo[?]"]). */
+  void writeCTypes(llvm::raw_ostream &OS);
+  /** Writes the index of the declarations written so far, a JSON object
+   * per line with the name, kind, hash, location and dependencies of each
+   * declaration. */
+  void writeIndex(llvm::raw_ostream &OS);
+  /** Records and typedefs written so far (with -ctypes or -layout). */
+  const std::vector<unsigned> &getWrittenTypeDecls() {
+    return WrittenTypeDecls;
+  }
+  /** Tells whether the declarations being resolved are the marked ones, as
+   * opposed to the ones they depend on. In compact mode, records that the
+   * latter only point to are left incomplete. */
+  void setResolvingMarkedDecls(bool ResolvingMarkedDecls_) {
+    ResolvingMarkedDecls = ResolvingMarkedDecls_;
+  }
+
   /** Try to resolve given anonymous record declaration. */
   void resolveAnonRecord(RecordDecl *RD);
 
@@ -209,46 +684,457 @@ public:
    *  @param parameterType    Type of the type being checked (parameter (PARAM),
    * return value (RETVAL) or neither (NONE). Used in the case when parentType
    * is FUNCTION.
+   * Results are memoized per type, so checking a type that has been checked
+   * before only adds its dependencies.
    * */
   void checkType(QualType Type, bool *isResolved,
-                 std::vector<std::string> *dependencyList,
+                 SmallVectorImpl<unsigned> *dependencyList,
                  std::string &DeclarationCore, enum ParentDeclType parentType,
                  enum ParamType parameterType);
 
 private:
-  static FFIBindingsUtils *instance;
-  FFIBindingsUtils() {
-    UnresolvedDeclarations = new std::map<std::string, DeclarationInfo>();
-    DeclsToFind = new std::stack<TypeDeclaration>();
-    ResolvedDecls = new std::set<std::string>();
-    blacklist = new std::set<std::string>();
-    AnonymousRecords = new std::vector<std::string>();
-  }
   FFIBindingsUtils(FFIBindingsUtils &);
   FFIBindingsUtils &operator=(FFIBindingsUtils &);
 
-  /** A map containing pairs of declaration names (types) and additional
+  /** Does the work of checkType() for a type that hasn't been checked yet. */
+  void checkTypeUncached(QualType Type, bool *isResolved,
+                         SmallVectorImpl<unsigned> *dependencyList,
+                         std::string &DeclarationCore,
+                         enum ParentDeclType parentType,
+                         enum ParamType parameterType);
+  /** Makes the declaration that is being checked depend on the given one (or
+   * records the dependency, while a result of checkType() is computed). */
+  void addTypeDependency(const TypeDeclaration &Dependency, bool *isResolved,
+                         SmallVectorImpl<unsigned> *dependencyList);
+  /** Returns the type at the end of a chain of typedefs (e.g. "int" for "c"
+   * in "typedef int a; typedef a b; typedef b c;"), with the qualifiers
+   * collected along the way. Stops at blacklisted typedefs and typedefs that
+   * name an unnamed record or enum. */
+  QualType foldTypedefChain(QualType Type);
+  /** Returns true if given declaration is spelled in the main file or in
+   * one of the exported headers. */
+  bool isInExportedFile(Decl *D);
+  /** Returns true if given declaration, whose name is spelled as on the
+   * blacklist, is excluded by the -filters patterns. */
+  bool isExcludedByFilter(Decl *D, const std::string &Name);
+  /** Starts the entry of a declaration with given name and kind ("function",
+   * "type" or "constant") in the loader's table (lazy mode only). */
+  void beginLazyEntry(llvm::raw_ostream &OS, StringRef Name, StringRef Kind);
+  /** Records the declaration of the variant of given function that takes
+   * (and returns) records through pointers (-shim), which is written after
+   * the function. The types it depends on are added to dependencyList too,
+   * so that they are written before the function. */
+  void addPointerVariant(FunctionDecl *FD, unsigned FunctionID,
+                         bool *isResolved,
+                         SmallVectorImpl<unsigned> *dependencyList);
+  /** Returns true if given function needs wrappers in the shim (-shim) and
+   * can have them; warns about a function that can't. */
+  bool needsShim(FunctionDecl *FD);
+  /** Writes the text of a declaration (see writeDeclaration()). */
+  void writeDeclarationText(llvm::raw_ostream &OS, StringRef Declaration);
+  /** Writes the names of the declarations a lazy entry depends on. */
+  void writeLazyDependencies(llvm::raw_ostream &OS,
+                             ArrayRef<unsigned> Dependencies);
+  /** Returns true if a pointer to the given type doesn't need the type to be
+   * declared (compact mode only; LuaJIT declares a struct or union that is
+   * used through a pointer as an incomplete type). */
+  bool isIncompletePointee(QualType PointeeType);
+
+  /** Declarations that have been given an ID, indexed by it. */
+  std::vector<Decl *> Decls;
+  /** IDs of (canonical) declarations. */
+  llvm::DenseMap<Decl *, unsigned> DeclIDs;
+  /** A map containing pairs of declaration IDs and additional
    *  information about them (e.g. a list of declarations they depend on).
    *  This map contains declarations that cannot be resolved immediately
-   *  (contain non-primitive types). */
-  std::map<std::string, DeclarationInfo> *UnresolvedDeclarations;
+   *  (contain non-primitive types). Iterates in insertion order. */
+  llvm::MapVector<unsigned, DeclarationInfo> *UnresolvedDeclarations;
+  /** Arena holding the text and the dependencies of unresolved
+   * declarations; freed at once when the consumer is done with them. */
+  llvm::BumpPtrAllocator Allocator;
   /** A list of declarations that need to be found. */
   std::stack<TypeDeclaration> *DeclsToFind;
-  /** A list of resolved (printed out) declarations. */
-  std::set<std::string> *ResolvedDecls;
-  std::vector<std::string> *AnonymousRecords;
-  std::string outputFileName = "";
-  std::string headerFileName = "";
-  std::string blacklistFileName = "";
-  std::string destinationDirectory = "";
+  /** Resolved (printed out) declarations, indexed by ID. */
+  llvm::BitVector ResolvedDecls;
+  /** Declarations that are on the blacklist, indexed by ID. */
+  llvm::BitVector BlacklistedDecls;
+  /** Names of anonymous records (see getAnonRecordName()). */
+  llvm::DenseMap<RecordDecl *, std::string> AnonRecordNames;
+  llvm::StringSet<> UsedAnonRecordNames;
+  /** Memoized results of checkType(), keyed by the type and the kind of the
+   * declarator. */
+  llvm::DenseMap<std::pair<void *, unsigned>, CheckTypeResult>
+      CheckTypeResults;
+  /** Dependencies of the type being checked, while its result is computed. */
+  std::vector<TypeDeclaration> *CheckTypeDependencies;
+  /** See setResolvingMarkedDecls(). */
+  bool ResolvingMarkedDecls = true;
+  /** Number of declarations (and forward declarations) written so far in
+   * lazy mode; the position of a declaration in the output. */
+  unsigned NumWrittenDeclarations = 0;
+  /** Positions of forward declarations in lazy mode, by declaration ID. */
+  llvm::DenseMap<unsigned, unsigned> ForwardDeclarations;
+  /** Variant of a function that takes records through pointers (-shim). */
+  struct PointerVariant {
+    std::string Name;
+    std::string Declaration;
+    std::vector<unsigned> Dependencies;
+  };
+  /** Pointer variants by the ID of their function. Each is written as an
+   * entry of its own, so that the lazy loader and the index know it by its
+   * name. */
+  llvm::DenseMap<unsigned, PointerVariant> PointerVariants;
+  /** Writes the pointer variant of the function with given ID. */
+  void writePointerVariant(llvm::raw_ostream &OS, unsigned ID,
+                           const PointerVariant &Variant);
+  /** Files that contain the declarations written so far (only with
+   * -depfile). */
+  llvm::SetVector<const FileEntry *> ContributingFiles;
+  /** Declarations written so far (only with -index). */
+  std::vector<IndexEntry> IndexEntries;
+  /** Adds a declaration that has been written to the index. */
+  void addToIndex(unsigned ID, bool isForwardDeclaration, StringRef Text,
+                  ArrayRef<unsigned> Dependencies, StringRef Name = "");
+  /** Records and typedefs written so far (see getWrittenTypeDecls()). */
+  std::vector<unsigned> WrittenTypeDecls;
+  FFIBindingsOptions options;
+  FFIBindingsStats stats;
   std::set<std::string> *blacklist;
+  /** Patterns read from the -filters file. */
+  DeclarationFilter Filter;
+  /** Wrappers written with the -shim option. */
+  ShimWriter Shim;
+  /** Whether the declarations of each file are exported (see
+   * isInExportedFile()). */
+  llvm::DenseMap<FileID, bool> ExportedFiles;
   ASTContext *Context;
-  /** Output string for writing the output to a file. */
-  std::string *output;
-  /** This flag is set to true when 'test' is passed on the command line. */
-  bool isTestingMode = false;
+  /** Output stream declarations are printed to. */
+  llvm::raw_ostream *output;
   /** Used to check if the plugin should generate an output .lua file. Remains
    * false if there are no declarations marked with the ffibinding attribute. */
   bool markedDeclarations = false;
 };
+
+/**
+ * Output file that is written through a buffered stream to a temporary file
+ * in the destination directory. The temporary file is atomically renamed to
+ * the final file name when the output is committed, so a partially written
+ * file is never visible under that name (e.g. if the compiler is killed
+ * while writing). If the output isn't committed, the temporary file is
+ * removed.
+ **/
+class OutputSink {
+public:
+  OutputSink(std::string fileName_) : fileName(fileName_) {}
+  ~OutputSink() { discard(); }
+  /** Creates the temporary file. Returns false if it can't be created. */
+  bool open(std::error_code &Err);
+  /** Stream that the output is written to (valid after open()). */
+  llvm::raw_ostream &stream() { return *Stream; }
+  /** Flushes the output and renames the temporary file to the final file
+   * name, unless the final file already has the same contents (then it is
+   * not touched). Returns false if the output can't be written. */
+  bool commit(std::error_code &Err);
+  /** Removes the temporary file without touching the final file. */
+  void discard();
+
+private:
+  OutputSink(const OutputSink &);
+  OutputSink &operator=(const OutputSink &);
+
+  std::string fileName;
+  llvm::SmallString<128> tempFileName;
+  std::unique_ptr<llvm::raw_fd_ostream> Stream;
+
+  /** Returns true if the final file has the same contents as the temporary
+   * one. */
+  bool isUnchanged();
+};
+
+/**
+ * On-disk cache of generated output files. An output file is stored under a
+ * key that is a hash of everything it depends on: the contents of the main
+ * file and of all included files, the header and blacklist files, predefined
+ * macros, the target and the plugin arguments. When the key of a translation
+ * unit is found in the cache, the cached output is reused and declarations
+ * don't have to be resolved at all.
+ **/
+class BindingCache {
+public:
+  BindingCache(std::string cacheDirectory_) : cacheDirectory(cacheDirectory_) {}
+  /** Computes the key of the current translation unit.
+   *  @param Context      AST context of the translation unit
+   *  @param Predefines   Predefined macros (command line macros included)
+   *  @param Options      Strings that affect the output (e.g. file names)
+   *  @param InputFiles   Additional files whose contents affect the output
+   *  Returns false if some of the inputs can't be read, in which case the
+   * cache shouldn't be used. */
+  bool computeKey(ASTContext &Context, const std::string &Predefines,
+                  const std::vector<std::string> &Options,
+                  const std::vector<std::string> &InputFiles);
+  /** Copies a file that was stored with the output (e.g. the index) from
+   * the cache. Returns false if it isn't in the cache. */
+  bool restoreFile(const std::string &suffix, const std::string &fileName);
+  /** Stores a file that belongs to the output under the current key; has to
+   * be called before store(), as the output marks a complete entry. */
+  void storeFile(const std::string &suffix, const std::string &fileName);
+  /** Copies the cached output to the given file and reads the files it
+   * depends on (see store()). Returns false if there is no cached output
+   * for the current key. */
+  bool restore(const std::string &outputFileName,
+               std::vector<std::string> &Dependencies);
+  /** Stores the given output file in the cache, with the list of files it
+   * depends on (for the -depfile option). */
+  void store(const std::string &outputFileName,
+             const std::vector<std::string> &Dependencies);
+
+private:
+  std::string cacheDirectory;
+  std::string key;
+
+  std::string getCacheFileName() { return cacheDirectory + key + ".lua"; }
+  std::string getDependencyFileName() {
+    return cacheDirectory + key + ".deps";
+  }
+  /** Copies a file through an OutputSink. */
+  static bool copyFile(const std::string &From, const std::string &To);
+};
+
+/**
+ * Layout of the emitted records as computed by clang, written with the
+ * -layout option to a Lua module next to the generated bindings. The module
+ * contains the size, the alignment and the field offsets of every record,
+ * a self-test that compares them with what LuaJIT computes, and a report of
+ * padding holes and of fields that straddle cache lines.
+ **/
+class RecordLayoutTable {
+public:
+  RecordLayoutTable(FFIBindingsUtils *utils_, ASTContext &Context_)
+      : utils(utils_), Context(Context_) {}
+  /** Writes the module for the bindings in the given file. */
+  void write(llvm::raw_ostream &OS, const std::string &BindingsFileName);
+
+private:
+  FFIBindingsUtils *utils;
+  ASTContext &Context;
+
+  /** Writes the entry of a record named Name in the output. */
+  void writeRecord(llvm::raw_ostream &OS, const std::string &Name,
+                   const RecordDecl *RD);
+  /** Total padding and the number of straddling fields in all records. */
+  uint64_t TotalPadding = 0;
+  unsigned NumStraddling = 0;
+};
+
+/**
+ * Records object-like macros as they are defined (-macros). At the end of
+ * the translation unit, the ones defined in files with marked declarations
+ * whose body is an integer constant expression (of literals and other such
+ * macros) are evaluated and written to the ffi.cdef block as static const
+ * declarations, which LuaJIT folds into the traces that use them.
+ **/
+class MacroConstantCollector : public PPCallbacks {
+public:
+  MacroConstantCollector(Preprocessor &PP_)
+      : PP(PP_), HitDepthLimit(false) {}
+
+  void MacroDefined(const Token &MacroNameTok,
+                    const MacroDirective *MD) override;
+
+  void MacroUndefined(const Token &MacroNameTok,
+                      const MacroDefinition &MD) override;
+
+  /** Records the macros that are currently defined, for a translation unit
+   * that has been loaded instead of parsed (e.g. from an AST file). */
+  void collectDefinedMacros();
+  /** Writes the constants defined in given files to the output. */
+  void writeConstants(FFIBindingsUtils *utils, llvm::raw_ostream &OS,
+                      const llvm::SmallPtrSetImpl<const FileEntry *> &Files);
+
+private:
+  /** Position in the tokens of the macro being evaluated. */
+  struct Cursor {
+    ArrayRef<Token> Tokens;
+    unsigned Pos;
+    /** Number of macros expanded to get to these tokens. */
+    unsigned Depth;
+  };
+
+  /** Value of an evaluated macro. */
+  struct MacroValue {
+    /** False if the macro couldn't be evaluated exactly. */
+    bool isValid;
+    /** The body is a single literal of an unsigned type (e.g. "1u" or
+     * "0xffffffff"); such macros can't be used in expressions. */
+    bool isUnsigned;
+    int64_t Value;
+  };
+
+  Preprocessor &PP;
+  /** Object-like macros in the order they were first defined; NULL for the
+   * ones that have been undefined or can't be constants. */
+  llvm::MapVector<const IdentifierInfo *, const MacroInfo *> Macros;
+  /** Macros that have been evaluated (or failed to), so that a macro used by
+   * many others is only evaluated once. */
+  llvm::DenseMap<const MacroInfo *, MacroValue> Evaluated;
+  /** Macros that failed because of the expansion depth limit, with the
+   * smallest depth they failed from; they are only evaluated again from a
+   * smaller depth. */
+  llvm::DenseMap<const MacroInfo *, unsigned> DepthLimited;
+  /** Set when an evaluation fails because of the depth limit, so that the
+   * macros that were being evaluated don't cache their failures. */
+  bool HitDepthLimit;
+
+  /** Evaluates the body of given macro. Its value is invalid unless the body
+   * is a single integer literal or an expression of type int, which can be
+   * evaluated exactly (unsigned operands and casts to types other than int
+   * are refused). */
+  MacroValue evaluateMacro(const MacroInfo *MI, unsigned Depth);
+  bool evaluateConditional(Cursor &C, int64_t &Value);
+  /** Evaluates binary operators of at least given precedence. */
+  bool evaluateExpression(Cursor &C, int64_t &Value, unsigned MinPrecedence);
+  bool evaluatePrimary(Cursor &C, int64_t &Value);
+  bool evaluateNumber(const Token &Tok, int64_t &Value, bool &isUnsigned);
+};
+
+/**
+ * Prints out declarations that could not be resolved immediately (the ones in
+ * the UnresolvedDeclarations map) so that every declaration comes after the
+ * declarations it depends on.
+ *
+ * The dependency graph is built once and declarations are printed using
+ * Kahn's algorithm. When no declaration is ready to be printed, the remaining
+ * dependency cycles are found once as strongly connected components (Tarjan)
+ * and broken, dependencies first, by forward declaring records from each of
+ * them. Declarations that depend on something that can never be resolved
+ * are reported and skipped.
+ **/
+class DeclarationOrderer {
+public:
+  DeclarationOrderer(FFIBindingsUtils *utils_, DiagnosticsEngine &DE_)
+      : utils(utils_), DE(DE_) {}
+  /** Prints out all unresolved declarations to the given output. */
+  void emitDeclarations(llvm::raw_ostream &output);
+
+private:
+  FFIBindingsUtils *utils;
+  DiagnosticsEngine &DE;
+  llvm::raw_ostream *output;
+
+  /** IDs of unresolved declarations, numbered in the order of the map. */
+  std::vector<unsigned> Nodes;
+  /** Information about each of the unresolved declarations. */
+  std::vector<DeclarationInfo *> NodeInfo;
+  /** For each declaration, the declarations that depend on it. */
+  std::vector<std::vector<unsigned>> Dependents;
+  /** Number of dependencies of each declaration that are not printed yet. */
+  std::vector<unsigned> InDegree;
+  std::vector<bool> Emitted;
+  std::vector<bool> ForwardDeclared;
+  std::vector<bool> Dropped;
+  /** Number of declarations that are neither printed nor dropped. */
+  unsigned NumPending;
+  /** Declarations whose dependencies are all printed (smallest index first,
+   * which keeps the output in the order of the map where possible). */
+  std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>>
+      Ready;
+
+  bool isPending(unsigned Node) { return !Emitted[Node] && !Dropped[Node]; }
+  /** Prints out the full declaration and releases its dependents. */
+  void emit(unsigned Node);
+  /** Prints out a forward declaration and releases its dependents. */
+  void forwardDeclare(unsigned Node);
+  void release(unsigned Node);
+  /** Skips this declaration and every declaration that depends on it. */
+  void drop(unsigned Node, unsigned Reason);
+  /** Prints out the declarations that are ready to be printed, and the
+   * ones they release. */
+  void emitReady();
+  /** Forward declares records of a strongly connected component whose
+   * dependencies outside of it are printed, until the component is printed;
+   * drops what is left if it runs out of records. */
+  void breakCycles(ArrayRef<unsigned> Component);
+  /** Numbers the strongly connected components of the graph formed by
+   * pending declarations, in the order Tarjan's algorithm completes them
+   * (reverse topological order). Returns the number of components. */
+  unsigned findSCCs(std::vector<unsigned> &SCC);
+};
+
+/**
+ * Class used for generating required FFI bindings by traversing through
+ * the parsed AST and extracting relevant information from the
+ * appropriate nodes.
+ *
+ * Implementation of the ASTConsumer interface.
+ * It implements HandleTranslationUnit method, which gets called when
+ * the AST for entire translation unit has been parsed.
+ *
+ **/
+class GenerateFFIBindingsConsumer : public ASTConsumer {
+public:
+  /** If bindingsOutput is given, only the contents of the ffi.cdef block
+   * are printed to it instead of writing the output file. */
+  GenerateFFIBindingsConsumer(const FFIBindingsOptions &options,
+                              std::string predefines_,
+                              llvm::raw_ostream *bindingsOutput_ = NULL)
+      : utils(new FFIBindingsUtils(options)), MarkedDeclsVisitor(utils),
+        FunctionsVisitor(utils), RecordsVisitor(utils), EnumsVisitor(utils),
+        TypedefsVisitor(utils), predefines(predefines_),
+        bindingsOutput(bindingsOutput_) {}
+
+  ~GenerateFFIBindingsConsumer() { delete utils; }
+
+  /** Sets the collector of the macros of the translation unit, whose
+   * constants are written after the declarations (-macros). It is owned by
+   * the preprocessor. */
+  void setMacroConstants(MacroConstantCollector *MacroConstants_) {
+    MacroConstants = MacroConstants_;
+  }
+
+  virtual bool HandleTopLevelDecl(DeclGroupRef DG);
+
+  virtual void HandleTagDeclDefinition(TagDecl *D);
+
+  virtual void HandleTranslationUnit(clang::ASTContext &context);
+
+private:
+  /** Resolution state of the translation unit. */
+  FFIBindingsUtils *utils;
+  MarkedDeclVisitor MarkedDeclsVisitor;
+  FunctionVisitor FunctionsVisitor;
+  RecordVisitor RecordsVisitor;
+  EnumVisitor EnumsVisitor;
+  TypedefVisitor TypedefsVisitor;
+  /** Predefined macros of the translation unit (part of the cache key). */
+  std::string predefines;
+  llvm::raw_ostream *bindingsOutput;
+  MacroConstantCollector *MacroConstants = NULL;
+
+  /** Generates the output file (or the bindings, see bindingsOutput). */
+  void generateOutput(clang::ASTContext &context);
+  /** Prints out the time report and writes the statistics file, if
+   * requested. */
+  void reportStats(clang::ASTContext &context);
+  /** Resolves collected declarations and prints them out to the given
+   * output. Returns false if the blacklist, the filters or the shim macros
+   * can't be read. */
+  bool generateBindings(clang::ASTContext &context, llvm::raw_ostream &output);
+  /** Returns the name of the index file of the given output file (e.g.
+   * "test.idx.jsonl" for "test.lua"). */
+  static std::string getIndexFileName(const std::string &outputFileName);
+  /** Writes the index of the emitted declarations next to the output file
+   * (-index). Returns false if it can't be written. */
+  bool generateIndexFile(const std::string &outputFileName);
+  /** Writes the C file of wrappers (-shim). Returns false if it can't be
+   * written. */
+  bool generateShimFile(const std::string &shimFileName);
+  /** Writes the Makefile-style dependency file of the output file, if
+   * requested (-depfile). */
+  void writeDepFile(const std::string &target,
+                    const std::vector<std::string> &dependencies);
+  /** Writes the layout of the emitted records next to the output file
+   * (-layout). */
+  void generateLayoutFile(clang::ASTContext &context,
+                          const std::string &outputFileName);
+};
 #endif /* GENERATEFFIBINDINGS_H */
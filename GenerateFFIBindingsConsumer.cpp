@@ -0,0 +1,576 @@
+#include "GenerateFFIBindings.hpp"
+
+/** The part of a lazy module after the table of declarations (see
+ * FFIBindingsUtils::writeDeclaration()). */
+static const char *LazyLoader = R"lua(end)(declarations)
+
+local M = {clib = ffi.C}
+local defined = {}
+
+-- adds the declaration with given name and the declarations it depends on
+-- that aren't defined yet to the list, as {position, text}
+local function collect(name, list, seen)
+  local declaration = declarations[name]
+  if not declaration or defined[name] or seen[name] then
+    return
+  end
+  seen[name] = true
+  list[#list + 1] = {declaration[2], declaration[3]}
+  if declaration[5] then
+    list[#list + 1] = {declaration[5], name .. ";"}
+  end
+  for _, dependency in ipairs(declaration[4]) do
+    collect(dependency, list, seen)
+  end
+end
+
+-- defines the symbol with given name and everything it depends on, in the
+-- order they were generated in; returns false if there is no such symbol
+function M.cdef(name)
+  if not declarations[name] then
+    return false
+  end
+  local list, seen = {}, {}
+  collect(name, list, seen)
+  table.sort(list, function(a, b) return a[1] < b[1] end)
+  local text = {}
+  for i, item in ipairs(list) do
+    text[i] = item[2]
+  end
+  if #text > 0 then
+    ffi.cdef(table.concat(text, "\n"))
+  end
+  for defined_name in pairs(seen) do
+    defined[defined_name] = true
+  end
+  return true
+end
+
+-- functions and constants are looked up in M.clib (ffi.C unless it is
+-- replaced with a library loaded with ffi.load()), the other symbols are
+-- ctypes; "T[?]" is the ctype of variable length arrays of T
+return setmetatable(M, {__index = function(t, name)
+  local symbol = name:match("^(.*)%[%?%]$") or name
+  if not M.cdef(symbol) then
+    return nil
+  end
+  local value
+  if declarations[symbol][1] ~= "type" then
+    if symbol ~= name then
+      return nil
+    end
+    value = M.clib[name]
+  else
+    value = ffi.typeof(name)
+  end
+  rawset(t, name, value)
+  return value
+end})
+)lua";
+
+bool GenerateFFIBindingsConsumer::HandleTopLevelDecl(DeclGroupRef DG) {
+
+  // declarations that need to be resolved are collected while the
+  // translation unit is being parsed, so it doesn't have to be traversed
+  PhaseTimer Timer(utils->getStats(), FFIBindingsStats::COLLECT);
+  for (DeclGroupRef::iterator I = DG.begin(), E = DG.end(); I != E; ++I)
+    MarkedDeclsVisitor.collectTopLevelDecl(*I);
+  return true;
+}
+
+void GenerateFFIBindingsConsumer::HandleTagDeclDefinition(TagDecl *D) {
+  PhaseTimer Timer(utils->getStats(), FFIBindingsStats::COLLECT);
+  MarkedDeclsVisitor.collectTagDefinition(D);
+}
+
+void GenerateFFIBindingsConsumer::HandleTranslationUnit(
+    clang::ASTContext &context) {
+
+  generateOutput(context);
+  reportStats(context);
+
+  // the consumer may be leaked by the frontend (-disable-free), so the
+  // resolution state and its arena are released here
+  delete utils;
+  utils = NULL;
+}
+
+void GenerateFFIBindingsConsumer::generateOutput(clang::ASTContext &context) {
+
+  DiagnosticsEngine &DE = context.getDiagnostics();
+  if (DE.hasErrorOccurred()) {
+    llvm::outs() << "----------------------------------\n";
+    llvm::outs() << "--------- ffi-gen plugin ---------\n";
+    llvm::outs() << "----------------------------------\n";
+    llvm::outs() << "Error has occurred during compilation ";
+    llvm::outs() << "- ffi bindings will not be generated.\n\n";
+    return;
+  }
+
+  // declarations loaded from a precompiled header or a module are not
+  // passed to HandleTopLevelDecl(), so they can only be found by traversing
+  // the whole translation unit
+  if (context.getExternalSource()) {
+    PhaseTimer Timer(utils->getStats(), FFIBindingsStats::COLLECT);
+    MarkedDeclsVisitor.clear();
+    MarkedDeclsVisitor.TraverseDecl(context.getTranslationUnitDecl());
+  }
+
+  // there is nothing to generate if nothing is marked
+  if (MarkedDeclsVisitor.empty())
+    return;
+
+  std::error_code Err;
+
+  // declarations are collected by the caller, which takes care of the rest
+  // of the output
+  if (bindingsOutput) {
+    generateBindings(context, *bindingsOutput);
+    return;
+  }
+
+  std::string outputFileName = utils->getOutputFileName();
+  std::string headerFileName = utils->getHeaderFileName();
+  std::string blacklistFileName = utils->getBlacklistFileName();
+  std::string filtersFileName = utils->getFiltersFileName();
+  std::string shimMacrosFileName = utils->getShimMacrosFileName();
+  std::string shimFileName =
+      utils->getDestinationDirectory() + utils->getShimFileName();
+
+  // an AST file records the file it was built from as its main file, but
+  // the file may not be available anymore
+  const FileEntry *MainFile = context.getSourceManager().getFileEntryForID(
+      context.getSourceManager().getMainFileID());
+  if (!MainFile) {
+    llvm::errs() << "Error: the main file of the translation unit is not "
+                    "available!\n";
+    return;
+  }
+  std::string sourceFileName = MainFile->getName();
+  std::string dirName =
+      context.getSourceManager().getFileManager().getCanonicalName(
+          MainFile->getDir());
+
+  char separator;
+#ifdef LLVM_ON_UNIX
+  separator = '/';
+#else
+  separator = '\\';
+#endif
+  dirName += separator;
+  if (sourceFileName.find_last_of(separator) != std::string::npos)
+    sourceFileName =
+        sourceFileName.substr(sourceFileName.find_last_of(separator) + 1);
+
+  if (utils->isTestingModeOn()) {
+    outputFileName = sourceFileName;
+    outputFileName.replace(
+        outputFileName.find_first_of('.'),
+        outputFileName.length() - outputFileName.find_first_of('.'), "");
+    outputFileName = dirName + outputFileName;
+    std::replace(outputFileName.begin(), outputFileName.end(), separator,
+                 '_');
+
+    outputFileName += ".lua";
+  }
+
+  sourceFileName = ">> " + dirName + sourceFileName;
+
+  // if this translation unit has been seen before (with the same contents
+  // of every file it includes), the output can be taken from the cache;
+  // the layout file needs the records to be resolved, so it can't be
+  // generated from the cache
+  BindingCache Cache(utils->getCacheDirectory());
+  bool useCache = false;
+  if (utils->getCacheDirectory() != "" && !utils->isLayoutModeOn()) {
+    std::vector<std::string> Options = utils->getPluginArguments();
+    Options.push_back(outputFileName);
+    Options.push_back(sourceFileName);
+    std::vector<std::string> InputFiles;
+    InputFiles.push_back(headerFileName);
+    InputFiles.push_back(blacklistFileName);
+    InputFiles.push_back(filtersFileName);
+    InputFiles.push_back(shimMacrosFileName);
+    useCache = Cache.computeKey(context, predefines, Options, InputFiles);
+    // the index and the shim are restored first, the output marks a
+    // complete entry
+    std::vector<std::string> Dependencies;
+    std::string indexFileName =
+        utils->getDestinationDirectory() + getIndexFileName(outputFileName);
+    if (useCache &&
+        (!utils->isIndexModeOn() ||
+         Cache.restoreFile(".idx.jsonl", indexFileName)) &&
+        (!utils->isShimModeOn() || Cache.restoreFile(".c", shimFileName)) &&
+        Cache.restore(utils->getDestinationDirectory() + outputFileName,
+                      Dependencies)) {
+      writeDepFile(utils->getDestinationDirectory() + outputFileName,
+                   Dependencies);
+      return;
+    }
+  }
+
+  // the output is streamed to a temporary file, which replaces the output
+  // file only once it has been completely written
+  OutputSink output(utils->getDestinationDirectory() + outputFileName);
+  if (!output.open(Err)) {
+    llvm::errs() << "Error creating file \"" << outputFileName
+                 << "\" : " << Err.message() << "!\n";
+    return;
+  }
+
+  if (headerFileName != "") {
+    PhaseTimer Timer(utils->getStats(), FFIBindingsStats::WRITE);
+    std::string line;
+    std::ifstream headerFile(headerFileName);
+    if (headerFile.is_open()) {
+      while (getline(headerFile, line)) {
+        if (line.find(constants::SRC_FILE_PLACE_HOLDER) != std::string::npos)
+          line.replace(line.find(constants::SRC_FILE_PLACE_HOLDER),
+                       constants::SRC_FILE_PLACE_HOLDER.length(),
+                       sourceFileName);
+        output.stream() << line << "\n";
+      }
+      headerFile.close();
+    } else {
+      llvm::outs() << "Error opening file: \"" << headerFileName << "\"\n";
+      return;
+    }
+  }
+
+  if (utils->isLazyModeOn())
+    output.stream() << "ffi = require(\"ffi\")\n"
+                       "local declarations = {}\n;(function(d)\n";
+  else {
+    output.stream() << "ffi = require(\"ffi\")\nffi.cdef[[\n";
+    if (!utils->isCompactModeOn())
+      output.stream() << "\n";
+  }
+
+  if (!generateBindings(context, output.stream()))
+    return;
+
+  // the lazy module returns ctypes anyway
+  if (utils->isLazyModeOn())
+    output.stream() << LazyLoader;
+  else {
+    output.stream() << "]]\n";
+    if (utils->isCTypesModeOn())
+      utils->writeCTypes(output.stream());
+  }
+
+  if (utils->hasMarkedDeclarations()) {
+    PhaseTimer Timer(utils->getStats(), FFIBindingsStats::WRITE);
+    if (!output.commit(Err)) {
+      llvm::errs() << "Error writing file \"" << outputFileName
+                   << "\" : " << Err.message() << "!\n";
+      return;
+    }
+
+    // the output depends on the files its declarations come from, and on
+    // the header, blacklist, filters and shim macros files
+    std::vector<std::string> Dependencies = utils->getContributingFiles();
+    if (headerFileName != "")
+      Dependencies.push_back(headerFileName);
+    if (blacklistFileName != "")
+      Dependencies.push_back(blacklistFileName);
+    if (filtersFileName != "")
+      Dependencies.push_back(filtersFileName);
+    if (shimMacrosFileName != "")
+      Dependencies.push_back(shimMacrosFileName);
+    writeDepFile(utils->getDestinationDirectory() + outputFileName,
+                 Dependencies);
+
+    if (utils->isIndexModeOn() && !generateIndexFile(outputFileName))
+      useCache = false;
+
+    if (utils->isShimModeOn() && !generateShimFile(shimFileName))
+      useCache = false;
+
+    if (useCache) {
+      if (utils->isIndexModeOn())
+        Cache.storeFile(".idx.jsonl", utils->getDestinationDirectory() +
+                                          getIndexFileName(outputFileName));
+      if (utils->isShimModeOn())
+        Cache.storeFile(".c", shimFileName);
+      Cache.store(utils->getDestinationDirectory() + outputFileName,
+                  Dependencies);
+    }
+    if (utils->isLayoutModeOn())
+      generateLayoutFile(context, outputFileName);
+  }
+}
+
+std::string GenerateFFIBindingsConsumer::getIndexFileName(
+    const std::string &outputFileName) {
+
+  // "foo_gen_ffi.lua" -> "foo_gen_ffi.idx.jsonl"
+  std::string indexFileName = outputFileName;
+  if (StringRef(indexFileName).endswith(".lua"))
+    indexFileName.resize(indexFileName.size() - 4);
+  return indexFileName + ".idx.jsonl";
+}
+
+bool GenerateFFIBindingsConsumer::generateIndexFile(
+    const std::string &outputFileName) {
+
+  std::string indexFileName = getIndexFileName(outputFileName);
+  std::error_code Err;
+  OutputSink indexFile(utils->getDestinationDirectory() + indexFileName);
+  if (!indexFile.open(Err)) {
+    llvm::errs() << "Error creating file \"" << indexFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+  utils->writeIndex(indexFile.stream());
+  if (!indexFile.commit(Err)) {
+    llvm::errs() << "Error writing file \"" << indexFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+  return true;
+}
+
+bool GenerateFFIBindingsConsumer::generateShimFile(
+    const std::string &shimFileName) {
+
+  std::error_code Err;
+  OutputSink shimFile(shimFileName);
+  if (!shimFile.open(Err)) {
+    llvm::errs() << "Error creating file \"" << shimFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+  utils->getShim()->write(shimFile.stream());
+  if (!shimFile.commit(Err)) {
+    llvm::errs() << "Error writing file \"" << shimFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+  return true;
+}
+
+/** Escapes a file name for a Makefile rule. */
+static std::string escapeMakeFileName(StringRef FileName) {
+
+  std::string Escaped;
+  for (char c : FileName) {
+    if (c == ' ' || c == '#')
+      Escaped += '\\';
+    else if (c == '$')
+      Escaped += '$';
+    Escaped += c;
+  }
+  return Escaped;
+}
+
+void GenerateFFIBindingsConsumer::writeDepFile(
+    const std::string &target, const std::vector<std::string> &dependencies) {
+
+  std::string depFileName = utils->getDepFileName();
+  if (depFileName == "")
+    return;
+
+  std::error_code Err;
+  OutputSink depFile(depFileName);
+  if (!depFile.open(Err)) {
+    llvm::errs() << "Error creating file \"" << depFileName
+                 << "\" : " << Err.message() << "!\n";
+    return;
+  }
+  depFile.stream() << escapeMakeFileName(target) << ":";
+  for (const std::string &dependency : dependencies)
+    depFile.stream() << " \\\n  " << escapeMakeFileName(dependency);
+  depFile.stream() << "\n";
+  if (!depFile.commit(Err))
+    llvm::errs() << "Error writing file \"" << depFileName
+                 << "\" : " << Err.message() << "!\n";
+}
+
+void GenerateFFIBindingsConsumer::generateLayoutFile(
+    clang::ASTContext &context, const std::string &outputFileName) {
+
+  // "foo_gen_ffi.lua" -> "foo_gen_ffi_layout.lua"
+  std::string layoutFileName = outputFileName;
+  if (StringRef(layoutFileName).endswith(".lua"))
+    layoutFileName.resize(layoutFileName.size() - 4);
+  layoutFileName += "_layout.lua";
+
+  std::error_code Err;
+  OutputSink layoutFile(utils->getDestinationDirectory() + layoutFileName);
+  if (!layoutFile.open(Err)) {
+    llvm::errs() << "Error creating file \"" << layoutFileName
+                 << "\" : " << Err.message() << "!\n";
+    return;
+  }
+  RecordLayoutTable Table(utils, context);
+  Table.write(layoutFile.stream(), outputFileName);
+  if (!layoutFile.commit(Err))
+    llvm::errs() << "Error writing file \"" << layoutFileName
+                 << "\" : " << Err.message() << "!\n";
+}
+
+bool GenerateFFIBindingsConsumer::generateBindings(clang::ASTContext &context,
+                                                   llvm::raw_ostream &output) {
+
+  std::string blacklistFileName = utils->getBlacklistFileName();
+  if (blacklistFileName != "") {
+    std::string line;
+    std::ifstream blacklistFile(blacklistFileName);
+    if (blacklistFile.is_open()) {
+      while (getline(blacklistFile, line)) {
+        utils->getBlacklist()->insert(line);
+      }
+      blacklistFile.close();
+    } else {
+      llvm::outs() << "Error opening file: \"" << blacklistFileName << "\"\n";
+      return false;
+    }
+  }
+
+  std::string filtersFileName = utils->getFiltersFileName();
+  if (filtersFileName != "") {
+    std::string Error;
+    if (!utils->getFilter()->load(filtersFileName, Error)) {
+      llvm::outs() << Error << "\n";
+      return false;
+    }
+  }
+
+  std::string shimMacrosFileName = utils->getShimMacrosFileName();
+  if (utils->isShimModeOn() && shimMacrosFileName != "") {
+    std::string Error;
+    if (!utils->getShim()->loadMacros(shimMacrosFileName, Error)) {
+      llvm::outs() << Error << "\n";
+      return false;
+    }
+  }
+
+  utils->setOutput(&output);
+  utils->setContext(&context);
+  FFIBindingsStats *stats = utils->getStats();
+  uint64_t outputStart = output.tell();
+  stats->increment(FFIBindingsStats::DECLS_MARKED,
+                   MarkedDeclsVisitor.getFunctions().size() +
+                       MarkedDeclsVisitor.getRecords().size() +
+                       MarkedDeclsVisitor.getEnums().size() +
+                       MarkedDeclsVisitor.getTypedefs().size());
+
+  {
+    PhaseTimer Timer(stats, FFIBindingsStats::RESOLVE);
+    // resolve function declarations and extract information
+    // about unresolved dependencies, if there are any
+    for (FunctionDecl *FD : MarkedDeclsVisitor.getFunctions())
+      FunctionsVisitor.VisitFunctionDecl(FD);
+    // start resolving record declarations that are marked with ffibinding
+    // attribute
+    for (RecordDecl *RD : MarkedDeclsVisitor.getRecords())
+      RecordsVisitor.VisitRecordDecl(RD);
+    // print out enum declarations that are marked with ffibinding attribute
+    for (EnumDecl *ED : MarkedDeclsVisitor.getEnums())
+      EnumsVisitor.VisitEnumDecl(ED);
+    // start resolving typedef declarations that are marked with ffibinding
+    // attribute
+    for (TypedefNameDecl *TD : MarkedDeclsVisitor.getTypedefs())
+      TypedefsVisitor.VisitTypedefDecl(TD);
+  }
+
+  {
+    PhaseTimer Timer(stats, FFIBindingsStats::FIND);
+    utils->setResolvingMarkedDecls(false);
+    // go through DeclsToFind until all required declarations are found
+    while (utils->getDeclsToFind()->size() > 0) {
+
+      stats->updatePeak(FFIBindingsStats::PEAK_DECLS_TO_FIND,
+                        utils->getDeclsToFind()->size());
+
+      TypeDeclaration Decl = utils->getDeclsToFind()->top();
+      utils->getDeclsToFind()->pop();
+
+      const Type *DeclType = Decl.Declaration->getTypeForDecl();
+
+      if (!utils->isInResolvedDecls(Decl.ID) &&
+          !utils->isInUnresolvedDeclarations(Decl.ID)) {
+        if (DeclType->getAs<TypedefType>())
+          utils->resolveTypedefDecl((TypedefNameDecl *)Decl.Declaration);
+        else if (DeclType->isRecordType()) {
+          if (Decl.Declaration->getNameAsString() == "")
+            utils->resolveAnonRecord((RecordDecl *)Decl.Declaration);
+          else
+            utils->resolveRecordDecl((RecordDecl *)Decl.Declaration);
+        } else if (DeclType->isEnumeralType())
+          utils->resolveEnumDecl((EnumDecl *)Decl.Declaration);
+      }
+    }
+  }
+
+  stats->increment(FFIBindingsStats::DEFERRED,
+                   utils->getUnresolvedDeclarations()->size());
+
+  {
+    PhaseTimer Timer(stats, FFIBindingsStats::EMIT);
+    // print out the remaining declarations after the declarations they
+    // depend on
+    DeclarationOrderer Orderer(utils, context.getDiagnostics());
+    Orderer.emitDeclarations(output);
+
+    // constants come from the files that the marked declarations are in
+    if (MacroConstants) {
+      llvm::SmallPtrSet<const FileEntry *, 16> Files;
+      SourceManager &SM = context.getSourceManager();
+      auto addFile = [&](Decl *D) {
+        Files.insert(SM.getFileEntryForID(
+            SM.getFileID(SM.getExpansionLoc(D->getLocation()))));
+      };
+      for (FunctionDecl *FD : MarkedDeclsVisitor.getFunctions())
+        addFile(FD);
+      for (RecordDecl *RD : MarkedDeclsVisitor.getRecords())
+        addFile(RD);
+      for (EnumDecl *ED : MarkedDeclsVisitor.getEnums())
+        addFile(ED);
+      for (TypedefNameDecl *TD : MarkedDeclsVisitor.getTypedefs())
+        addFile(TD);
+      MacroConstants->writeConstants(utils, output, Files);
+    }
+
+    // the types that wrapped macros use are up to the -shim-macros file
+    for (const MacroPrototype &Macro : utils->getShim()->getMacros())
+      utils->writeMacroDeclaration(
+          output, Macro.Name, "function",
+          Macro.ReturnType + " " + Macro.Name + "(" + Macro.ParameterList +
+              ") __asm__(\"" + ShimWriter::getWrapperName(Macro.Name) +
+              "\");\n");
+  }
+
+  stats->increment(FFIBindingsStats::BYTES_EMITTED,
+                   output.tell() - outputStart);
+  stats->increment(FFIBindingsStats::DECL_IDS, utils->getNumDeclIDs());
+  return true;
+}
+
+void GenerateFFIBindingsConsumer::reportStats(clang::ASTContext &context) {
+
+  FFIBindingsStats *stats = utils->getStats();
+  if (!stats->isEnabled())
+    return;
+
+  if (utils->isTimeReportOn())
+    stats->printTimeReport(llvm::errs());
+
+  std::string statsFileName = utils->getStatsFileName();
+  if (statsFileName == "")
+    return;
+
+  std::error_code Err;
+  OutputSink statsFile(statsFileName);
+  if (!statsFile.open(Err)) {
+    llvm::errs() << "Error creating file \"" << statsFileName
+                 << "\" : " << Err.message() << "!\n";
+    return;
+  }
+  const FileEntry *MainFile = context.getSourceManager().getFileEntryForID(
+      context.getSourceManager().getMainFileID());
+  stats->printJSON(statsFile.stream(), MainFile ? MainFile->getName() : "");
+  if (!statsFile.commit(Err))
+    llvm::errs() << "Error writing file \"" << statsFileName
+                 << "\" : " << Err.message() << "!\n";
+}
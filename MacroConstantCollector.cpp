@@ -0,0 +1,416 @@
+#include "GenerateFFIBindings.hpp"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/APInt.h"
+
+namespace {
+/** Macros that expand to other macros are only followed this deep. */
+const unsigned MAX_EXPANSION_DEPTH = 32;
+
+typedef std::pair<const IdentifierInfo *, const MacroInfo *> MacroEntry;
+
+/** Returns the precedence of a binary operator (higher binds tighter), 0
+ * if the token isn't one. */
+unsigned getBinaryPrecedence(tok::TokenKind Kind) {
+
+  switch (Kind) {
+  case tok::star:
+  case tok::slash:
+  case tok::percent:
+    return 10;
+  case tok::plus:
+  case tok::minus:
+    return 9;
+  case tok::lessless:
+  case tok::greatergreater:
+    return 8;
+  case tok::less:
+  case tok::lessequal:
+  case tok::greater:
+  case tok::greaterequal:
+    return 7;
+  case tok::equalequal:
+  case tok::exclaimequal:
+    return 6;
+  case tok::amp:
+    return 5;
+  case tok::caret:
+    return 4;
+  case tok::pipe:
+    return 3;
+  case tok::ampamp:
+    return 2;
+  case tok::pipepipe:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/** Returns true if the token is a keyword of a signed integer type at least
+ * as wide as int (e.g. "long" or "signed"); casts to such types don't change
+ * values of type int. */
+bool isIntTypeKeyword(const Token &Tok) {
+
+  return Tok.is(tok::kw_int) || Tok.is(tok::kw_signed) ||
+         Tok.is(tok::kw_long);
+}
+
+/** Returns true if the value can be represented by the type int. Every
+ * operand and result of an evaluated expression has to be, so that the
+ * expression is evaluated as C would evaluate it (with no overflow). */
+bool isIntValue(int64_t Value) {
+
+  return Value >= INT32_MIN && Value <= INT32_MAX;
+}
+
+/** Applies a binary operator. Returns false on overflow, division by zero
+ * and shifts the result of which isn't defined. */
+bool applyBinaryOperator(tok::TokenKind Kind, int64_t LHS, int64_t RHS,
+                         int64_t &Result) {
+
+  bool Overflow = false;
+  llvm::APInt L(64, LHS, true), R(64, RHS, true);
+  switch (Kind) {
+  case tok::star:
+    Result = L.smul_ov(R, Overflow).getSExtValue();
+    return !Overflow;
+  case tok::plus:
+    Result = L.sadd_ov(R, Overflow).getSExtValue();
+    return !Overflow;
+  case tok::minus:
+    Result = L.ssub_ov(R, Overflow).getSExtValue();
+    return !Overflow;
+  case tok::slash:
+  case tok::percent:
+    if (RHS == 0 || (LHS == INT64_MIN && RHS == -1))
+      return false;
+    Result = Kind == tok::slash ? LHS / RHS : LHS % RHS;
+    return true;
+  case tok::lessless:
+    if (LHS < 0 || RHS < 0 || RHS >= 63 || (LHS >> (63 - RHS)) != 0)
+      return false;
+    Result = LHS << RHS;
+    return true;
+  case tok::greatergreater:
+    if (RHS < 0 || RHS >= 64)
+      return false;
+    Result = LHS >> RHS;
+    return true;
+  case tok::less:
+    Result = LHS < RHS;
+    return true;
+  case tok::lessequal:
+    Result = LHS <= RHS;
+    return true;
+  case tok::greater:
+    Result = LHS > RHS;
+    return true;
+  case tok::greaterequal:
+    Result = LHS >= RHS;
+    return true;
+  case tok::equalequal:
+    Result = LHS == RHS;
+    return true;
+  case tok::exclaimequal:
+    Result = LHS != RHS;
+    return true;
+  case tok::amp:
+    Result = LHS & RHS;
+    return true;
+  case tok::caret:
+    Result = LHS ^ RHS;
+    return true;
+  case tok::pipe:
+    Result = LHS | RHS;
+    return true;
+  case tok::ampamp:
+    Result = LHS && RHS;
+    return true;
+  case tok::pipepipe:
+    Result = LHS || RHS;
+    return true;
+  default:
+    return false;
+  }
+}
+}
+
+void MacroConstantCollector::MacroDefined(const Token &MacroNameTok,
+                                          const MacroDirective *MD) {
+
+  // macros that can't be constants are still recorded, so that a
+  // redefinition replaces the previous definition
+  const MacroInfo *MI = MD->getMacroInfo();
+  bool isCandidate = MI && MI->isObjectLike() && !MI->isBuiltinMacro() &&
+                     MI->getNumTokens() > 0;
+  Macros[MacroNameTok.getIdentifierInfo()] = isCandidate ? MI : NULL;
+}
+
+void MacroConstantCollector::MacroUndefined(const Token &MacroNameTok,
+                                            const MacroDefinition &MD) {
+
+  llvm::MapVector<const IdentifierInfo *, const MacroInfo *>::iterator it =
+      Macros.find(MacroNameTok.getIdentifierInfo());
+  if (it != Macros.end())
+    it->second = NULL;
+}
+
+void MacroConstantCollector::collectDefinedMacros() {
+
+  // macros loaded from an AST file are not reported to the callbacks; they
+  // are sorted by location, the order they would have been reported in
+  std::vector<MacroEntry> Defined;
+  for (Preprocessor::macro_iterator it = PP.macro_begin(),
+                                    end = PP.macro_end();
+       it != end; ++it) {
+    const MacroInfo *MI = PP.getMacroInfo(it->first);
+    if (MI && MI->isObjectLike() && !MI->isBuiltinMacro() &&
+        MI->getNumTokens() > 0)
+      Defined.push_back(std::make_pair(it->first, MI));
+  }
+
+  SourceManager &SM = PP.getSourceManager();
+  std::sort(Defined.begin(), Defined.end(),
+            [&SM](const MacroEntry &A, const MacroEntry &B) {
+              return SM.isBeforeInTranslationUnit(A.second->getDefinitionLoc(),
+                                                  B.second->getDefinitionLoc());
+            });
+  for (const MacroEntry &Macro : Defined)
+    Macros[Macro.first] = Macro.second;
+}
+
+void MacroConstantCollector::writeConstants(
+    FFIBindingsUtils *utils, llvm::raw_ostream &OS,
+    const llvm::SmallPtrSetImpl<const FileEntry *> &Files) {
+
+  SourceManager &SM = PP.getSourceManager();
+  for (const MacroEntry &Macro : Macros) {
+    if (!Macro.second)
+      continue;
+
+    // macros from the command line and predefined macros have no file
+    const FileEntry *File = SM.getFileEntryForID(
+        SM.getFileID(SM.getExpansionLoc(Macro.second->getDefinitionLoc())));
+    if (!File || !Files.count(File))
+      continue;
+
+    MacroValue Result = evaluateMacro(Macro.second, 0);
+    if (!Result.isValid)
+      continue;
+
+    // LuaJIT only supports constants of 32-bit integer types
+    int64_t Value = Result.Value;
+    std::string Type;
+    if (!Result.isUnsigned && isIntValue(Value))
+      Type = "int";
+    else if (Value >= 0 && Value <= UINT32_MAX)
+      Type = "unsigned int";
+    else
+      continue;
+
+    std::string Name = Macro.first->getName();
+    utils->writeMacroDeclaration(OS, Name, "constant",
+                                 "static const " + Type + " " + Name + " = " +
+                                     std::to_string(Value) + ";\n");
+  }
+}
+
+MacroConstantCollector::MacroValue
+MacroConstantCollector::evaluateMacro(const MacroInfo *MI, unsigned Depth) {
+
+  llvm::DenseMap<const MacroInfo *, MacroValue>::iterator it =
+      Evaluated.find(MI);
+  if (it != Evaluated.end())
+    return it->second;
+
+  MacroValue Result = {false, false, 0};
+  llvm::DenseMap<const MacroInfo *, unsigned>::iterator Limited =
+      DepthLimited.find(MI);
+  if (Depth > MAX_EXPANSION_DEPTH ||
+      (Limited != DepthLimited.end() && Depth >= Limited->second)) {
+    HitDepthLimit = true;
+    return Result;
+  }
+
+  // the macro is recorded as invalid while it is being evaluated, so that
+  // macros that refer to each other fail rather than recurse
+  Evaluated[MI] = Result;
+  bool OuterHitDepthLimit = HitDepthLimit;
+  HitDepthLimit = false;
+
+  if (MI->getNumTokens() == 1 &&
+      MI->getReplacementToken(0).is(tok::numeric_constant)) {
+    // a literal on its own keeps its type
+    Result.isValid = evaluateNumber(MI->getReplacementToken(0), Result.Value,
+                                    Result.isUnsigned);
+  } else {
+    Cursor C;
+    C.Tokens = ArrayRef<Token>(MI->tokens_begin(), MI->tokens_end());
+    C.Pos = 0;
+    C.Depth = Depth;
+    // the whole body has to be a single expression
+    Result.isValid =
+        evaluateConditional(C, Result.Value) && C.Pos == C.Tokens.size();
+  }
+
+  // a failure that comes from the depth limit isn't cached, as the macro
+  // may still be evaluated from a smaller depth
+  if (!Result.isValid && HitDepthLimit) {
+    Evaluated.erase(MI);
+    DepthLimited[MI] = Depth;
+  } else {
+    Evaluated[MI] = Result;
+    HitDepthLimit = false;
+  }
+  HitDepthLimit = HitDepthLimit || OuterHitDepthLimit;
+  return Result;
+}
+
+bool MacroConstantCollector::evaluateConditional(Cursor &C, int64_t &Value) {
+
+  if (!evaluateExpression(C, Value, 1))
+    return false;
+  if (C.Pos >= C.Tokens.size() || C.Tokens[C.Pos].isNot(tok::question))
+    return true;
+
+  C.Pos++;
+  int64_t TrueValue, FalseValue;
+  if (!evaluateConditional(C, TrueValue))
+    return false;
+  if (C.Pos >= C.Tokens.size() || C.Tokens[C.Pos].isNot(tok::colon))
+    return false;
+  C.Pos++;
+  if (!evaluateConditional(C, FalseValue))
+    return false;
+  Value = Value ? TrueValue : FalseValue;
+  return true;
+}
+
+bool MacroConstantCollector::evaluateExpression(Cursor &C, int64_t &Value,
+                                                unsigned MinPrecedence) {
+
+  if (!evaluatePrimary(C, Value))
+    return false;
+
+  // operators of the same precedence are left associative
+  while (C.Pos < C.Tokens.size()) {
+    tok::TokenKind Kind = C.Tokens[C.Pos].getKind();
+    unsigned Precedence = getBinaryPrecedence(Kind);
+    if (Precedence == 0 || Precedence < MinPrecedence)
+      return true;
+    C.Pos++;
+    int64_t RHS;
+    if (!evaluateExpression(C, RHS, Precedence + 1))
+      return false;
+    // shifting by the width of int or more is undefined
+    if ((Kind == tok::lessless || Kind == tok::greatergreater) && RHS >= 32)
+      return false;
+    if (!applyBinaryOperator(Kind, Value, RHS, Value) || !isIntValue(Value))
+      return false;
+  }
+  return true;
+}
+
+bool MacroConstantCollector::evaluatePrimary(Cursor &C, int64_t &Value) {
+
+  if (C.Pos >= C.Tokens.size())
+    return false;
+  const Token &Tok = C.Tokens[C.Pos++];
+
+  switch (Tok.getKind()) {
+  case tok::numeric_constant: {
+    bool isUnsigned;
+    return evaluateNumber(Tok, Value, isUnsigned) && !isUnsigned &&
+           isIntValue(Value);
+  }
+
+  case tok::identifier: {
+    // only other object-like macros can be part of a constant
+    llvm::MapVector<const IdentifierInfo *, const MacroInfo *>::iterator it =
+        Macros.find(Tok.getIdentifierInfo());
+    if (it == Macros.end() || !it->second)
+      return false;
+    MacroValue Result = evaluateMacro(it->second, C.Depth + 1);
+    Value = Result.Value;
+    return Result.isValid && !Result.isUnsigned && isIntValue(Value);
+  }
+
+  case tok::l_paren: {
+    // casts to int and wider signed types don't change values of type int;
+    // any other type name (e.g. "(unsigned char)") isn't an operand, so the
+    // cast is refused
+    if (C.Pos < C.Tokens.size() && isIntTypeKeyword(C.Tokens[C.Pos])) {
+      while (C.Pos < C.Tokens.size() && isIntTypeKeyword(C.Tokens[C.Pos]))
+        C.Pos++;
+      if (C.Pos >= C.Tokens.size() || C.Tokens[C.Pos].isNot(tok::r_paren))
+        return false;
+      C.Pos++;
+      return evaluatePrimary(C, Value);
+    }
+    if (!evaluateConditional(C, Value))
+      return false;
+    if (C.Pos >= C.Tokens.size() || C.Tokens[C.Pos].isNot(tok::r_paren))
+      return false;
+    C.Pos++;
+    return true;
+  }
+
+  case tok::plus:
+    return evaluatePrimary(C, Value);
+
+  case tok::minus:
+    if (!evaluatePrimary(C, Value))
+      return false;
+    Value = -Value;
+    return isIntValue(Value);
+
+  case tok::tilde:
+    if (!evaluatePrimary(C, Value))
+      return false;
+    Value = ~Value;
+    return true;
+
+  case tok::exclaim:
+    if (!evaluatePrimary(C, Value))
+      return false;
+    Value = !Value;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+bool MacroConstantCollector::evaluateNumber(const Token &Tok, int64_t &Value,
+                                           bool &isUnsigned) {
+
+  // the literal is parsed here rather than with NumericLiteralParser, which
+  // reports malformed numbers as errors, and a macro that is never used may
+  // well contain one (e.g. "#define VERSION 1.2.3")
+  SmallString<32> Buffer;
+  bool Invalid = false;
+  StringRef Spelling = PP.getSpelling(Tok, Buffer, &Invalid);
+  if (Invalid)
+    return false;
+
+  isUnsigned = false;
+  while (!Spelling.empty() &&
+         (Spelling.back() == 'u' || Spelling.back() == 'U' ||
+          Spelling.back() == 'l' || Spelling.back() == 'L')) {
+    if (Spelling.back() == 'u' || Spelling.back() == 'U')
+      isUnsigned = true;
+    Spelling = Spelling.drop_back();
+  }
+
+  uint64_t Number;
+  if (Spelling.empty() || Spelling.getAsInteger(0, Number) ||
+      Number > (uint64_t)INT64_MAX)
+    return false;
+  // hexadecimal and octal literals that don't fit in int may have an
+  // unsigned type (e.g. 0xffffffff is an unsigned int), decimal ones never do
+  if (Number > INT32_MAX && Spelling.size() > 1 && Spelling[0] == '0')
+    isUnsigned = true;
+  Value = Number;
+  return true;
+}
@@ -0,0 +1,59 @@
+#include "GenerateFFIBindings.hpp"
+
+void MarkedDeclVisitor::collectTopLevelDecl(Decl *D) {
+
+  if (FunctionDecl *FD = dyn_cast<FunctionDecl>(D))
+    VisitFunctionDecl(FD);
+  else if (TypedefNameDecl *TD = dyn_cast<TypedefNameDecl>(D))
+    VisitTypedefDecl(TD);
+  else if (TagDecl *TD = dyn_cast<TagDecl>(D)) {
+    // definitions are reported separately, with nested ones included
+    if (!TD->isThisDeclarationADefinition())
+      collectTagDefinition(TD);
+  } else if (isa<LinkageSpecDecl>(D) || isa<NamespaceDecl>(D)) {
+    for (Decl *Child : cast<DeclContext>(D)->decls())
+      collectTopLevelDecl(Child);
+  }
+}
+
+void MarkedDeclVisitor::collectTagDefinition(TagDecl *TD) {
+
+  if (RecordDecl *RD = dyn_cast<RecordDecl>(TD))
+    VisitRecordDecl(RD);
+  else if (EnumDecl *ED = dyn_cast<EnumDecl>(TD))
+    VisitEnumDecl(ED);
+}
+
+bool MarkedDeclVisitor::VisitFunctionDecl(FunctionDecl *FD) {
+  utils->getStats()->increment(FFIBindingsStats::DECLS_VISITED);
+  if (utils->isTestingModeOn() || utils->isMarked(FD))
+    Functions.push_back(FD);
+
+  return true;
+}
+
+bool MarkedDeclVisitor::VisitRecordDecl(RecordDecl *RD) {
+  utils->getStats()->increment(FFIBindingsStats::DECLS_VISITED);
+  // unnamed records are bound through the typedefs that name them
+  if (utils->isMarked(RD) &&
+      (RD->hasAttr<FFIBindingAttr>() || RD->getNameAsString() != ""))
+    Records.push_back(RD);
+
+  return true;
+}
+
+bool MarkedDeclVisitor::VisitEnumDecl(EnumDecl *ED) {
+  utils->getStats()->increment(FFIBindingsStats::DECLS_VISITED);
+  if (utils->isMarked(ED))
+    Enums.push_back(ED);
+
+  return true;
+}
+
+bool MarkedDeclVisitor::VisitTypedefDecl(TypedefNameDecl *TD) {
+  utils->getStats()->increment(FFIBindingsStats::DECLS_VISITED);
+  if (utils->isMarked(TD))
+    Typedefs.push_back(TD);
+
+  return true;
+}
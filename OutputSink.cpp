@@ -0,0 +1,89 @@
+#include "GenerateFFIBindings.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Signals.h"
+
+bool OutputSink::open(std::error_code &Err) {
+
+  int FD;
+  // the temporary file is created next to the final one, so that renaming it
+  // doesn't cross file systems
+  Err = llvm::sys::fs::createUniqueFile(fileName + "-%%%%%%.tmp", FD,
+                                        tempFileName);
+  if (Err)
+    return false;
+
+  llvm::sys::RemoveFileOnSignal(tempFileName);
+  Stream.reset(new llvm::raw_fd_ostream(FD, /*shouldClose=*/true));
+  return true;
+}
+
+bool OutputSink::commit(std::error_code &Err) {
+
+  if (!Stream) {
+    Err = std::make_error_code(std::errc::bad_file_descriptor);
+    return false;
+  }
+
+  Stream->close();
+  if (Stream->has_error()) {
+    Err = std::make_error_code(std::errc::io_error);
+    discard();
+    return false;
+  }
+  Stream.reset();
+
+  // a file that hasn't changed is left alone, so that its modification time
+  // doesn't make the build system redo everything that depends on it
+  if (isUnchanged()) {
+    llvm::sys::fs::remove(tempFileName);
+    llvm::sys::DontRemoveFileOnSignal(tempFileName);
+    return true;
+  }
+
+  Err = llvm::sys::fs::rename(tempFileName, fileName);
+  if (Err) {
+    llvm::sys::fs::remove(tempFileName);
+    llvm::sys::DontRemoveFileOnSignal(tempFileName);
+    return false;
+  }
+  llvm::sys::DontRemoveFileOnSignal(tempFileName);
+  return true;
+}
+
+bool OutputSink::isUnchanged() {
+
+  uint64_t OldSize, NewSize;
+  if (llvm::sys::fs::file_size(fileName, OldSize) ||
+      llvm::sys::fs::file_size(tempFileName, NewSize) || OldSize != NewSize)
+    return false;
+
+  // the files are compared a chunk at a time, so that large outputs don't
+  // have to be held in memory twice
+  std::ifstream Old(fileName, std::ios::binary);
+  std::ifstream New(tempFileName.c_str(), std::ios::binary);
+  if (!Old.is_open() || !New.is_open())
+    return false;
+  const size_t ChunkSize = 64 * 1024;
+  std::unique_ptr<char[]> OldChunk(new char[ChunkSize]);
+  std::unique_ptr<char[]> NewChunk(new char[ChunkSize]);
+  for (uint64_t Left = OldSize; Left > 0;) {
+    size_t Size = std::min<uint64_t>(Left, ChunkSize);
+    if (!Old.read(OldChunk.get(), Size) || !New.read(NewChunk.get(), Size) ||
+        memcmp(OldChunk.get(), NewChunk.get(), Size) != 0)
+      return false;
+    Left -= Size;
+  }
+  return true;
+}
+
+void OutputSink::discard() {
+
+  if (!Stream)
+    return;
+
+  Stream->close();
+  Stream->clear_error();
+  Stream.reset();
+  llvm::sys::fs::remove(tempFileName);
+  llvm::sys::DontRemoveFileOnSignal(tempFileName);
+}
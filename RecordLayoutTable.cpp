@@ -0,0 +1,159 @@
+#include "GenerateFFIBindings.hpp"
+#include "clang/AST/RecordLayout.h"
+
+/** Part of the layout module after the table of records. */
+static const char *LayoutSelfTest = R"lua(
+-- compares the layout of every record with the one LuaJIT computes; the
+-- records have to be declared first (or a lazy bindings module, which
+-- declares them on access, can be passed); returns true, or false and the
+-- list of differences
+function M.selftest(bindings)
+  local differences = {}
+  local function check(name, what, expected, actual)
+    if expected ~= actual then
+      differences[#differences + 1] = string.format(
+          "%s: %s is %s, expected %s", name, what, tostring(actual),
+          tostring(expected))
+    end
+  end
+  for name, layout in pairs(M.records) do
+    if bindings then
+      local _ = bindings[name]
+    end
+    local ok, ctype = pcall(ffi.typeof, name)
+    if not ok then
+      differences[#differences + 1] = name .. ": " .. tostring(ctype)
+    else
+      check(name, "size", layout.size, ffi.sizeof(ctype))
+      check(name, "alignment", layout.align, ffi.alignof(ctype))
+      for _, field in ipairs(layout.fields) do
+        check(name, "offset of " .. field[1], field[2],
+              ffi.offsetof(ctype, field[1]))
+      end
+    end
+  end
+  return #differences == 0, differences
+end
+
+return M
+)lua";
+
+void RecordLayoutTable::write(llvm::raw_ostream &OS,
+                              const std::string &BindingsFileName) {
+
+  OS << "-- Layout of the records in " << BindingsFileName
+     << " as computed by clang.\n";
+  OS << "ffi = require(\"ffi\")\nlocal M = {records = {}}\n";
+  OS << ";(function(r)\n";
+
+  unsigned NumRecords = 0;
+  unsigned NumEntries = 0;
+  for (unsigned ID : utils->getWrittenTypeDecls()) {
+    const RecordDecl *RD = NULL;
+    Decl *D = utils->getDecl(ID);
+    if (RecordDecl *Record = dyn_cast<RecordDecl>(D))
+      RD = Record;
+    else if (TypedefNameDecl *TD = dyn_cast<TypedefNameDecl>(D)) {
+      // a typedef is the only name of an unnamed record
+      if (const RecordType *RT = TD->getUnderlyingType()->getAs<RecordType>())
+        if (RT->getDecl()->getNameAsString() == "")
+          RD = RT->getDecl();
+    }
+    if (!RD)
+      continue;
+    RD = RD->getDefinition();
+    if (!RD || RD->isInvalidDecl())
+      continue;
+
+    // every field is a constant of the function the table is built in
+    if (NumEntries >= constants::LUA_ENTRIES_PER_FUNCTION) {
+      OS << "end)(M.records)\n;(function(r)\n";
+      NumEntries = 0;
+    }
+    writeRecord(OS, utils->getDeclName(ID), RD);
+    NumEntries += 1 + std::distance(RD->field_begin(), RD->field_end());
+    NumRecords++;
+  }
+
+  OS << "end)(M.records)\n\n";
+  OS << "-- " << NumRecords << " records, " << TotalPadding
+     << " bytes of padding, " << NumStraddling << " fields straddling a "
+     << constants::CACHE_LINE_SIZE << "-byte cache line.\n";
+  OS << LayoutSelfTest;
+}
+
+void RecordLayoutTable::writeRecord(llvm::raw_ostream &OS,
+                                    const std::string &Name,
+                                    const RecordDecl *RD) {
+
+  const ASTRecordLayout &Layout = Context.getASTRecordLayout(RD);
+  uint64_t Size = Layout.getSize().getQuantity();
+  uint64_t CharWidth = Context.getCharWidth();
+
+  std::string Fields;
+  std::string Padding;
+  std::string Report;
+  uint64_t RecordPadding = 0;
+
+  // padding holes are found in bits, because of bit-fields; only the bytes
+  // that are entirely unused are reported
+  uint64_t End = 0;
+  for (RecordDecl::field_iterator FI = RD->field_begin(); FI != RD->field_end();
+       ++FI) {
+    uint64_t Offset = Layout.getFieldOffset(FI->getFieldIndex());
+    uint64_t Width = FI->isBitField() ? FI->getBitWidthValue(Context)
+                                      : Context.getTypeSize(FI->getType());
+
+    uint64_t HoleBegin = (End + CharWidth - 1) / CharWidth;
+    uint64_t HoleEnd = Offset / CharWidth;
+    if (Offset > End && HoleEnd > HoleBegin) {
+      Padding += "{" + std::to_string(HoleBegin) + ", " +
+                 std::to_string(HoleEnd - HoleBegin) + "}, ";
+      Report += "--   " + std::to_string(HoleEnd - HoleBegin) +
+                " bytes of padding at offset " + std::to_string(HoleBegin) +
+                "\n";
+      RecordPadding += HoleEnd - HoleBegin;
+    }
+    End = std::max(End, Offset + Width);
+
+    // offsets of bit-fields and of unnamed fields can't be compared
+    std::string FieldName = FI->getNameAsString();
+    if (FI->isBitField() || FieldName == "")
+      continue;
+
+    uint64_t FieldOffset = Offset / CharWidth;
+    uint64_t FieldSize = Width / CharWidth;
+    Fields += "{\"" + FieldName + "\", " + std::to_string(FieldOffset) + ", " +
+              std::to_string(FieldSize) + "}, ";
+
+    // a field that is larger than a cache line can't be helped
+    uint64_t LineSize = constants::CACHE_LINE_SIZE;
+    if (FieldSize > 0 && FieldSize <= LineSize &&
+        FieldOffset / LineSize != (FieldOffset + FieldSize - 1) / LineSize) {
+      Report += "--   field \"" + FieldName + "\" straddles a cache line " +
+                "(offset " + std::to_string(FieldOffset) + ", " +
+                std::to_string(FieldSize) + " bytes)\n";
+      NumStraddling++;
+    }
+  }
+
+  uint64_t TailBegin = (End + CharWidth - 1) / CharWidth;
+  if (Size > TailBegin) {
+    Padding += "{" + std::to_string(TailBegin) + ", " +
+               std::to_string(Size - TailBegin) + "}, ";
+    Report += "--   " + std::to_string(Size - TailBegin) +
+              " bytes of tail padding\n";
+    RecordPadding += Size - TailBegin;
+  }
+  TotalPadding += RecordPadding;
+
+  OS << "-- " << Name << ": " << Size << " bytes, " << RecordPadding
+     << " bytes of padding\n"
+     << Report;
+  OS << "r[\"";
+  OS.write_escaped(Name);
+  OS << "\"] = {size = " << Size
+     << ", align = " << Layout.getAlignment().getQuantity() << ",\n"
+     << "  fields = {" << Fields << "},\n"
+     << "  padding = {" << Padding << "}}\n";
+}
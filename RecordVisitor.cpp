@@ -1,17 +1,28 @@
 #include "GenerateFFIBindings.hpp"
 
 bool RecordVisitor::VisitRecordDecl(RecordDecl *RD) {
-  // try to resolve record declaration if it has ffibinding attribute
-  if (!RD->hasAttr<FFIBindingAttr>())
+  // try to resolve record declaration if it has ffibinding attribute (or is
+  // exported)
+  if (!utils->isMarked(RD))
     return true;
 
+  // the fields are found in the definition, which an exported forward
+  // declaration may come before
+  if (RecordDecl *Definition = RD->getDefinition())
+    RD = Definition;
+
   // if this record type has already been resolved, then there's nothing to do
-  if (!FFIBindingsUtils::getInstance()->isNewType(
-           RD->getTypeForDecl()->getCanonicalTypeInternal()))
+  unsigned RecordID = utils->getDeclID(RD);
+  if (!utils->isNewType(RecordID))
+    return true;
+
+  if (utils->isOnBlacklist(RecordID)) {
+    utils->addToResolvedDecls(RecordID);
     return true;
+  }
 
-  FFIBindingsUtils::getInstance()->setHasMarkedDeclarations(true);
-  FFIBindingsUtils::getInstance()->resolveRecordDecl(RD);
+  utils->setHasMarkedDeclarations(true);
+  utils->resolveRecordDecl(RD);
 
   return true;
 }
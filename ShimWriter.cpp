@@ -0,0 +1,226 @@
+#include "GenerateFFIBindings.hpp"
+#include "clang/Basic/CharInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace {
+/** Returns the identifier at the end of given text (e.g. "b" for "int *b"),
+ * or "" if it doesn't end with one. */
+StringRef getTrailingIdentifier(StringRef Text) {
+
+  Text = Text.rtrim();
+  size_t Begin = Text.size();
+  while (Begin > 0 && isIdentifierBody(Text[Begin - 1]))
+    Begin--;
+  StringRef Identifier = Text.substr(Begin);
+  if (Identifier.empty() || isDigit(Identifier[0]))
+    return "";
+  return Identifier;
+}
+}
+
+bool ShimWriter::needsWrapper(FunctionDecl *FD) {
+
+  // functions with internal linkage (e.g. static inline functions in
+  // headers) are not exported by any library
+  return !FD->isExternallyVisible() && !FD->isVariadic();
+}
+
+bool ShimWriter::hasRecordByValue(FunctionDecl *FD) {
+
+  if (FD->isVariadic())
+    return false;
+  if (FD->getReturnType()->isRecordType())
+    return true;
+  for (ParmVarDecl *PVD : FD->params()) {
+    if (PVD->getType()->isRecordType())
+      return true;
+  }
+  return false;
+}
+
+bool ShimWriter::canBeWrapped(FunctionDecl *FD) {
+
+  SourceManager &SM = FD->getASTContext().getSourceManager();
+  FileID File = SM.getFileID(SM.getExpansionLoc(FD->getLocation()));
+  return File != SM.getMainFileID() && SM.getFileEntryForID(File);
+}
+
+bool ShimWriter::loadMacros(const std::string &FileName, std::string &Error) {
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    Error = "Error opening file: \"" + FileName + "\"";
+    return false;
+  }
+
+  SmallVector<StringRef, 32> Lines;
+  (*Buffer)->getBuffer().split(Lines, "\n", -1, false);
+  for (unsigned LineNumber = 0; LineNumber < Lines.size(); LineNumber++) {
+    StringRef Line = Lines[LineNumber].trim();
+    if (Line.empty() || Line.startswith("//"))
+      continue;
+    // preprocessor directives (e.g. the includes that define the macros)
+    // are copied to the shim as they are
+    if (Line.startswith("#")) {
+      Preamble += Line.str() + "\n";
+      continue;
+    }
+
+    // "int MAX(int a, int b);"
+    Line = Line.rtrim(';').rtrim();
+    size_t Open = Line.find('(');
+    StringRef Name;
+    if (Open != StringRef::npos && Line.endswith(")"))
+      Name = getTrailingIdentifier(Line.substr(0, Open));
+    if (Name.empty()) {
+      Error = FileName + ":" + std::to_string(LineNumber + 1) +
+              ": expected a prototype of a function-like macro";
+      return false;
+    }
+
+    MacroPrototype Macro;
+    Macro.Name = Name;
+    Macro.ReturnType =
+        Line.substr(0, Open).rtrim().drop_back(Name.size()).trim();
+    StringRef Parameters = Line.slice(Open + 1, Line.size() - 1).trim();
+    Macro.ParameterList = Parameters;
+    if (Macro.ReturnType.empty()) {
+      Error = FileName + ":" + std::to_string(LineNumber + 1) +
+              ": expected the return type of the macro";
+      return false;
+    }
+    if (Parameters != "" && Parameters != "void") {
+      SmallVector<StringRef, 8> List;
+      Parameters.split(List, ",");
+      for (StringRef Parameter : List) {
+        StringRef ParameterName = getTrailingIdentifier(Parameter);
+        if (ParameterName.empty()) {
+          Error = FileName + ":" + std::to_string(LineNumber + 1) +
+                  ": every parameter needs a name";
+          return false;
+        }
+        Macro.Parameters.push_back(ParameterName);
+      }
+    }
+    Macros.push_back(Macro);
+  }
+  return true;
+}
+
+void ShimWriter::addInclude(FunctionDecl *FD) {
+
+  SourceManager &SM = FD->getASTContext().getSourceManager();
+  FileID File = SM.getFileID(SM.getExpansionLoc(FD->getLocation()));
+  if (const FileEntry *FE = SM.getFileEntryForID(File))
+    Includes.insert(FE);
+}
+
+void ShimWriter::addWrapper(FunctionDecl *FD) {
+
+  addInclude(FD);
+  PrintingPolicy Policy = FD->getASTContext().getPrintingPolicy();
+
+  // parameters are renamed, as they may be unnamed
+  std::string Parameters;
+  std::string Arguments;
+  llvm::raw_string_ostream ParametersOS(Parameters);
+  for (unsigned i = 0; i < FD->getNumParams(); i++) {
+    std::string Argument = "a" + std::to_string(i);
+    if (i > 0) {
+      ParametersOS << ", ";
+      Arguments += ", ";
+    }
+    FD->getParamDecl(i)->getType().print(ParametersOS, Policy, Argument);
+    Arguments += Argument;
+  }
+  ParametersOS.flush();
+  if (Parameters == "")
+    Parameters = "void";
+
+  std::string Name = FD->getNameAsString();
+  llvm::raw_string_ostream OS(Wrappers);
+  FD->getReturnType().print(OS, Policy,
+                            getWrapperName(Name) + "(" + Parameters + ")");
+  OS << " {\n  ";
+  if (!FD->getReturnType()->isVoidType())
+    OS << "return ";
+  OS << Name << "(" << Arguments << ");\n}\n\n";
+}
+
+void ShimWriter::addPointerWrapper(FunctionDecl *FD) {
+
+  addInclude(FD);
+  ASTContext &Context = FD->getASTContext();
+  PrintingPolicy Policy = Context.getPrintingPolicy();
+  QualType ReturnType = FD->getReturnType();
+  bool returnsRecord = ReturnType->isRecordType();
+
+  // records are passed through pointers, and a record that is returned is
+  // stored to the first argument
+  std::string Parameters;
+  std::string Arguments;
+  llvm::raw_string_ostream ParametersOS(Parameters);
+  if (returnsRecord)
+    Context.getPointerType(ReturnType).print(ParametersOS, Policy,
+                                             "ffi_result");
+  for (unsigned i = 0; i < FD->getNumParams(); i++) {
+    QualType Type = FD->getParamDecl(i)->getType();
+    std::string Argument = "a" + std::to_string(i);
+    if (i > 0 || returnsRecord)
+      ParametersOS << ", ";
+    if (i > 0)
+      Arguments += ", ";
+    if (Type->isRecordType()) {
+      Context.getPointerType(Type.withConst()).print(ParametersOS, Policy,
+                                                      Argument);
+      Arguments += "*" + Argument;
+    } else {
+      Type.print(ParametersOS, Policy, Argument);
+      Arguments += Argument;
+    }
+  }
+  ParametersOS.flush();
+  if (Parameters == "")
+    Parameters = "void";
+
+  std::string Name = FD->getNameAsString();
+  llvm::raw_string_ostream OS(Wrappers);
+  std::string Declarator =
+      getWrapperName(getPointerVariantName(Name)) + "(" + Parameters + ")";
+  if (returnsRecord)
+    OS << "void " << Declarator;
+  else
+    ReturnType.print(OS, Policy, Declarator);
+  OS << " {\n  ";
+  if (returnsRecord)
+    OS << "*ffi_result = ";
+  else if (!ReturnType->isVoidType())
+    OS << "return ";
+  OS << Name << "(" << Arguments << ");\n}\n\n";
+}
+
+void ShimWriter::write(llvm::raw_ostream &OS) {
+
+  OS << "/* Exported wrappers of functions that LuaJIT can't call directly, "
+        "generated by ffi-gen. */\n\n";
+  for (const FileEntry *File : Includes) {
+    SmallString<256> Path(File->getName());
+    llvm::sys::fs::make_absolute(Path);
+    OS << "#include \"" << Path << "\"\n";
+  }
+  OS << Preamble << "\n" << Wrappers;
+
+  for (const MacroPrototype &Macro : Macros) {
+    OS << Macro.ReturnType << " " << getWrapperName(Macro.Name) << "("
+       << (Macro.ParameterList == "" ? "void" : Macro.ParameterList)
+       << ") {\n  ";
+    if (Macro.ReturnType != "void")
+      OS << "return ";
+    OS << Macro.Name << "(";
+    for (unsigned i = 0; i < Macro.Parameters.size(); i++)
+      OS << (i > 0 ? ", " : "") << Macro.Parameters[i];
+    OS << ");\n}\n\n";
+  }
+}
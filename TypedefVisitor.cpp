@@ -1,21 +1,21 @@
 #include "GenerateFFIBindings.hpp"
 
 bool TypedefVisitor::VisitTypedefDecl(TypedefNameDecl *TD) {
-  if (!TD->hasAttr<FFIBindingAttr>())
+  if (!utils->isMarked(TD))
     return true;
 
-  if (FFIBindingsUtils::getInstance()->isInResolvedDecls("typedef " +
-                                                         TD->getNameAsString()))
+  unsigned TypedefID = utils->getDeclID(TD);
+
+  if (utils->isInResolvedDecls(TypedefID))
     return true;
 
-  if (FFIBindingsUtils::getInstance()->isOnBlacklist(TD->getNameAsString())) {
-    FFIBindingsUtils::getInstance()->getResolvedDecls()->insert(
-        "typedef " + TD->getNameAsString());
+  if (utils->isOnBlacklist(TypedefID)) {
+    utils->addToResolvedDecls(TypedefID);
     return true;
   }
 
-  FFIBindingsUtils::getInstance()->setHasMarkedDeclarations(true);
-  FFIBindingsUtils::getInstance()->resolveTypedefDecl(TD);
+  utils->setHasMarkedDeclarations(true);
+  utils->resolveTypedefDecl(TD);
 
   return true;
 }
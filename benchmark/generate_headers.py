@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+# Generates synthetic C sources for benchmarking the ffi-gen plugin. Every
+# shape stresses a different part of declaration resolution; its size
+# controls the number of declarations that are generated.
+#
+# Usage: generate_headers.py [--shape=<name>] [--size=<n>] [--output-dir=<dir>]
+
+import argparse
+import os
+import sys
+
+MARK = "__attribute__((ffibinding))"
+PRIMITIVES = ["int", "unsigned int", "long", "double", "float", "char *",
+              "unsigned char", "short", "long long", "void *"]
+
+
+def functions(size):
+    """Marked functions with primitive parameters only (resolved directly)."""
+    lines = []
+    for i in range(size):
+        params = ", ".join("%s p%d" % (PRIMITIVES[(i + j) % len(PRIMITIVES)], j)
+                           for j in range(i % 5 + 1))
+        lines.append("int function_%d(%s) %s;" % (i, params, MARK))
+    return lines
+
+
+def chain(size):
+    """A chain of records, each containing the previous one by value. Only
+    the last one is marked, so all the others have to be found."""
+    lines = ["struct chain_0 { int value; };"]
+    for i in range(1, size):
+        lines.append("struct chain_%d { struct chain_%d previous; int value; };"
+                     % (i, i - 1))
+    lines.append("struct %s chain_top { struct chain_%d last; };"
+                 % (MARK, size - 1))
+    return lines
+
+
+def fanout(size):
+    """A marked record with a field of a distinct record type per field."""
+    lines = []
+    for i in range(size):
+        lines.append("struct leaf_%d { int a; double b; };" % i)
+    fields = " ".join("struct leaf_%d f%d;" % (i, i) for i in range(size))
+    lines.append("struct %s wide { %s };" % (MARK, fields))
+    return lines
+
+
+def recursion(size):
+    """Self-referential records and pairs of mutually recursive records."""
+    lines = []
+    for i in range(size // 2):
+        lines.append("struct %s node_%d { struct node_%d *next; int value; };"
+                     % (MARK, i, i))
+    for i in range(size - size // 2):
+        lines.append("struct pair_b_%d;" % i)
+        lines.append("struct pair_a_%d { struct pair_b_%d *b; int value; };"
+                     % (i, i))
+        lines.append("struct pair_b_%d { struct pair_a_%d *a; int value; };"
+                     % (i, i))
+        lines.append("void use_pair_%d(struct pair_a_%d *a) %s;" % (i, i, MARK))
+    return lines
+
+
+def anonymous(size):
+    """Records with nested anonymous structs and unions."""
+    lines = []
+    for i in range(size):
+        lines.append("struct %s anon_%d { union { int i; float f; } u; "
+                     "struct { char c; struct { long l; } inner; } s; };"
+                     % (MARK, i))
+    return lines
+
+
+def typedefs(size):
+    """Chains of typedefs, ten deep, ending in a record."""
+    lines = []
+    depth = 10
+    for i in range(max(size // depth, 1)):
+        lines.append("struct base_%d { int value; };" % i)
+        lines.append("typedef struct base_%d typedef_%d_0;" % (i, i))
+        for j in range(1, depth):
+            lines.append("typedef typedef_%d_%d typedef_%d_%d;" % (i, j - 1, i, j))
+        lines.append("typedef typedef_%d_%d marked_typedef_%d %s;"
+                     % (i, depth - 1, i, MARK))
+    return lines
+
+
+def enums(size):
+    """Marked enums with a thousand enumerators each."""
+    lines = []
+    width = 1000
+    for i in range(max(size // width, 1)):
+        values = ", ".join("enum_%d_value_%d = %d" % (i, j, j)
+                           for j in range(width))
+        lines.append("enum %s enum_%d { %s };" % (MARK, i, values))
+    return lines
+
+
+def mixed(size):
+    """All of the above, each taking an equal share of the declarations."""
+    lines = []
+    share = max(size // (len(SHAPES) - 1), 1)
+    for name, shape in sorted(SHAPES.items()):
+        if shape is not mixed:
+            lines.extend(shape(share))
+    return lines
+
+
+SHAPES = {
+    "functions": functions,
+    "chain": chain,
+    "fanout": fanout,
+    "recursion": recursion,
+    "anonymous": anonymous,
+    "typedefs": typedefs,
+    "enums": enums,
+    "mixed": mixed,
+}
+
+
+def generate(shape, size, output_dir):
+    """Writes <shape>_<size>.h and a source file that includes it. Returns
+    the path of the source file."""
+    name = "%s_%d" % (shape, size)
+    header = os.path.join(output_dir, name + ".h")
+    source = os.path.join(output_dir, name + ".c")
+    guard = name.upper() + "_H"
+    with open(header, "w") as f:
+        f.write("#ifndef %s\n#define %s\n\n" % (guard, guard))
+        f.write("\n".join(SHAPES[shape](size)))
+        f.write("\n\n#endif\n")
+    with open(source, "w") as f:
+        f.write("#include \"%s\"\n" % os.path.basename(header))
+    return source
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generates synthetic C sources for the ffi-gen plugin.")
+    parser.add_argument("--shape", choices=sorted(SHAPES), action="append",
+                        help="shape of the generated header (all by default)")
+    parser.add_argument("--size", type=int, action="append",
+                        help="number of declarations (1000 by default)")
+    parser.add_argument("--output-dir", default=".",
+                        help="directory where the files are generated")
+    args = parser.parse_args()
+
+    if not os.path.isdir(args.output_dir):
+        os.makedirs(args.output_dir)
+    for shape in args.shape or sorted(SHAPES):
+        for size in args.size or [1000]:
+            print(generate(shape, size, args.output_dir))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+# Runs the ffi-gen plugin on synthetic sources (see generate_headers.py) and
+# records the time and peak memory use of every run as JSON.
+#
+# Every source is compiled twice: once with -fsyntax-only, which is the cost
+# of the frontend alone, and once with the plugin. The difference between the
+# two is the time spent generating the bindings; the plugin's own statistics
+# (-stats) break it down into phases.
+#
+# Usage: run_benchmarks.py --clang=<clang> --plugin=<ffi-gen.so>
+#                          [--shape=<name>] [--size=<n>] [--repeat=<n>]
+#                          [--output=<results.json>]
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+import generate_headers
+
+
+def run(command):
+    """Runs the command and returns its wall time (in seconds) and peak
+    resident set size (in kilobytes)."""
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL,
+                               stderr=subprocess.PIPE)
+    stderr = process.stderr.read()
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+    if os.WIFSIGNALED(status):
+        process.returncode = -os.WTERMSIG(status)
+    else:
+        process.returncode = os.WEXITSTATUS(status)
+    if process.returncode != 0:
+        sys.stderr.write(stderr.decode(errors="replace"))
+        raise RuntimeError("command failed: " + " ".join(command))
+    # ru_maxrss is in bytes on macOS and in kilobytes elsewhere
+    rss = usage.ru_maxrss
+    if platform.system() == "Darwin":
+        rss //= 1024
+    return elapsed, rss
+
+
+def plugin_command(args, source, work_dir):
+    command = [args.clang, "-fsyntax-only", source,
+               "-Xclang", "-load", "-Xclang", args.plugin,
+               "-Xclang", "-plugin", "-Xclang", "ffi-gen"]
+    for arg in ["-destdir", work_dir, "-output", "output.lua",
+                "-stats", os.path.join(work_dir, "stats.json")]:
+        command += ["-Xclang", "-plugin-arg-ffi-gen", "-Xclang", arg]
+    return command
+
+
+def median(values):
+    values = sorted(values)
+    middle = len(values) // 2
+    if len(values) % 2:
+        return values[middle]
+    return (values[middle - 1] + values[middle]) / 2
+
+
+def benchmark(args, shape, size, work_dir):
+    source = generate_headers.generate(shape, size, work_dir)
+    frontend = [run([args.clang, "-fsyntax-only", source])
+                for _ in range(args.repeat)]
+    plugin = [run(plugin_command(args, source, work_dir))
+              for _ in range(args.repeat)]
+
+    # statistics (counters and per-phase times) of the last run
+    with open(os.path.join(work_dir, "stats.json")) as f:
+        stats = json.load(f)
+
+    frontend_time = median([t for t, _ in frontend])
+    total_time = median([t for t, _ in plugin])
+    return {
+        "shape": shape,
+        "size": size,
+        "frontend_seconds": frontend_time,
+        "total_seconds": total_time,
+        "ffi_gen_seconds": max(total_time - frontend_time, 0.0),
+        "frontend_peak_rss_kb": max(rss for _, rss in frontend),
+        "peak_rss_kb": max(rss for _, rss in plugin),
+        "output_bytes": os.path.getsize(os.path.join(work_dir, "output.lua")),
+        "phases": stats["phases"],
+        "counters": stats["counters"],
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmarks the ffi-gen plugin on synthetic sources.")
+    parser.add_argument("--clang", required=True, help="path to clang")
+    parser.add_argument("--plugin", required=True, help="path to ffi-gen.so")
+    parser.add_argument("--shape", choices=sorted(generate_headers.SHAPES),
+                        action="append",
+                        help="shape of the generated header (all by default)")
+    parser.add_argument("--size", type=int, action="append",
+                        help="number of declarations (1000, 10000 and 50000 "
+                             "by default)")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="number of runs of every benchmark (the median "
+                             "time is reported)")
+    parser.add_argument("--output", help="file the results are written to "
+                                         "(standard output by default)")
+    args = parser.parse_args()
+
+    version = subprocess.check_output([args.clang, "--version"])
+    results = {
+        "clang": version.decode(errors="replace").splitlines()[0],
+        "benchmarks": [],
+    }
+    with tempfile.TemporaryDirectory(prefix="ffi-gen-benchmark-") as work_dir:
+        for shape in args.shape or sorted(generate_headers.SHAPES):
+            for size in args.size or [1000, 10000, 50000]:
+                result = benchmark(args, shape, size, work_dir)
+                sys.stderr.write("%-10s %6d  %8.3fs  %8d KB\n"
+                                 % (shape, size, result["ffi_gen_seconds"],
+                                    result["peak_rss_kb"]))
+                results["benchmarks"].append(result)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+    else:
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,292 @@
+//===- FFICombine.cpp -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Combines Lua files generated by the ffi-gen plugin into a single file,
+// leaving out declarations that appear in more than one of them. This is a
+// native replacement for ffi-combine.lua and ffi-combine.sh that produces the
+// same output.
+//
+// Usage: ffi-combine [--output=<file>] [--header=<file>] [--footer=<file>]
+//                    [--jobs=<n>] <input files>
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+const StringRef HeaderBegin = "--[[";
+const StringRef HeaderEnd = "--]]";
+const StringRef FFIBlockBegin = "ffi.cdef[[";
+const StringRef FFIBlockEnd = "]]";
+const StringRef SourceListPlaceHolder = "<source-files>";
+const StringRef SourceFilePrefix = ">> ";
+
+const StringRef OutputOption = "--output=";
+const StringRef HeaderOption = "--header=";
+const StringRef FooterOption = "--footer=";
+const StringRef JobsOption = "--jobs=";
+
+/**
+ * A declaration block (consecutive non-empty lines inside the ffi.cdef block)
+ * together with its hash, which is computed by the thread that reads the
+ * file, so that merging only needs to compare blocks with equal hashes.
+ **/
+struct Binding {
+  StringRef Text;
+  unsigned Hash;
+};
+
+struct BindingInfo {
+  static inline Binding getEmptyKey() {
+    Binding B = {DenseMapInfo<StringRef>::getEmptyKey(), 0};
+    return B;
+  }
+  static inline Binding getTombstoneKey() {
+    Binding B = {DenseMapInfo<StringRef>::getTombstoneKey(), 0};
+    return B;
+  }
+  static unsigned getHashValue(const Binding &B) { return B.Hash; }
+  static bool isEqual(const Binding &LHS, const Binding &RHS) {
+    if (LHS.Text.data() == getEmptyKey().Text.data() ||
+        LHS.Text.data() == getTombstoneKey().Text.data() ||
+        RHS.Text.data() == getEmptyKey().Text.data() ||
+        RHS.Text.data() == getTombstoneKey().Text.data())
+      return LHS.Text.data() == RHS.Text.data();
+    return LHS.Hash == RHS.Hash && LHS.Text == RHS.Text;
+  }
+};
+
+/**
+ * Contents of one of the input files. Buffers are memory mapped and all the
+ * strings point into them, so nothing is copied until the output is written.
+ **/
+struct InputFile {
+  std::string FileName;
+  std::unique_ptr<MemoryBuffer> Buffer;
+  /** Lines of the file header that name the source files (">> ..."). */
+  std::vector<StringRef> SourceFiles;
+  /** Declaration blocks in the order they appear in the file. */
+  std::vector<Binding> Bindings;
+  bool Exists = false;
+};
+
+/** Calls Callback for every line of Text (without the line terminator). */
+template <typename CallbackT> void forEachLine(StringRef Text, CallbackT Callback) {
+  while (!Text.empty()) {
+    std::pair<StringRef, StringRef> Split = Text.split('\n');
+    Callback(Split.first);
+    Text = Split.second;
+  }
+}
+
+/** Reads the file and splits it into source file lines and bindings. */
+void readInputFile(InputFile &Input) {
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFile(Input.FileName);
+  if (!Buffer)
+    return;
+  Input.Buffer = std::move(*Buffer);
+  Input.Exists = true;
+
+  bool isStartBlock = true;
+  bool isEndBlock = false;
+  bool isInHeader = false;
+  // lines of the current binding are consecutive in the buffer, so the
+  // binding is just the range from its first to its last line
+  const char *BindingBegin = nullptr;
+  const char *BindingEnd = nullptr;
+
+  forEachLine(Input.Buffer->getBuffer(), [&](StringRef Line) {
+    if (Line == HeaderBegin)
+      isInHeader = true;
+
+    if (isInHeader && Line.find(SourceFilePrefix) != StringRef::npos)
+      Input.SourceFiles.push_back(Line);
+
+    if (Line == FFIBlockEnd)
+      isEndBlock = true;
+
+    if (!isStartBlock && !isEndBlock) {
+      if (Line.empty()) {
+        if (BindingBegin) {
+          Binding B;
+          B.Text = StringRef(BindingBegin, BindingEnd - BindingBegin);
+          B.Hash = hash_value(B.Text);
+          Input.Bindings.push_back(B);
+        }
+        BindingBegin = nullptr;
+      } else {
+        if (!BindingBegin)
+          BindingBegin = Line.begin();
+        BindingEnd = Line.end();
+      }
+    }
+
+    if (Line == FFIBlockBegin)
+      isStartBlock = false;
+
+    if (Line == HeaderEnd)
+      isInHeader = false;
+  });
+}
+
+/** Reads all input files, using up to NumJobs threads. */
+void readInputFiles(std::vector<InputFile> &Inputs, unsigned NumJobs) {
+
+  std::atomic<unsigned> NextInput(0);
+  auto Worker = [&]() {
+    for (unsigned i = NextInput++; i < Inputs.size(); i = NextInput++)
+      readInputFile(Inputs[i]);
+  };
+
+  if (NumJobs > Inputs.size())
+    NumJobs = Inputs.size();
+  std::vector<std::thread> Threads;
+  for (unsigned i = 1; i < NumJobs; i++)
+    Threads.push_back(std::thread(Worker));
+  Worker();
+  for (std::thread &Thread : Threads)
+    Thread.join();
+}
+}
+
+int main(int argc, char **argv) {
+
+  std::string outputFileName = "out.lua"; // default output file name
+  std::string headerFileName = "";
+  std::string footerFileName = "";
+  unsigned NumJobs = std::thread::hardware_concurrency();
+  std::vector<InputFile> Inputs;
+
+  // get names of the lua files to combine (and if set, output, header and
+  // footer file names)
+  for (int i = 1; i < argc; i++) {
+    StringRef Arg = argv[i];
+    if (Arg.startswith(OutputOption))
+      outputFileName = Arg.substr(OutputOption.size());
+    else if (Arg.startswith(HeaderOption))
+      headerFileName = Arg.substr(HeaderOption.size());
+    else if (Arg.startswith(FooterOption))
+      footerFileName = Arg.substr(FooterOption.size());
+    else if (Arg.startswith(JobsOption))
+      Arg.substr(JobsOption.size()).getAsInteger(10, NumJobs);
+    else {
+      Inputs.push_back(InputFile());
+      Inputs.back().FileName = Arg;
+    }
+  }
+  if (NumJobs == 0)
+    NumJobs = 1;
+
+  std::string header;
+  // position in the header where the list of source files is inserted
+  size_t sourcesIndex = std::string::npos;
+  if (headerFileName != "") {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> HeaderFile =
+        MemoryBuffer::getFile(headerFileName);
+    if (!HeaderFile) {
+      errs() << "File: " << headerFileName << " does not exist.\n";
+      return 1;
+    }
+    forEachLine((*HeaderFile)->getBuffer(), [&](StringRef Line) {
+      // line containing "<source-files>" token is not copied to the output,
+      // it serves as an indicator of where list of source files should be
+      // inserted
+      if (Line.find(SourceListPlaceHolder) != StringRef::npos)
+        sourcesIndex = header.size();
+      else
+        header += Line.str() + "\n";
+    });
+  }
+
+  std::string footer;
+  if (footerFileName != "") {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> FooterFile =
+        MemoryBuffer::getFile(footerFileName);
+    if (!FooterFile) {
+      errs() << "File: " << footerFileName << " does not exist.\n";
+      return 1;
+    }
+    forEachLine((*FooterFile)->getBuffer(),
+                [&](StringRef Line) { footer += Line.str() + "\n"; });
+  }
+
+  readInputFiles(Inputs, NumJobs);
+
+  for (InputFile &Input : Inputs) {
+    if (!Input.Exists) {
+      errs() << "File: " << Input.FileName << " does not exist.\n";
+      return 1;
+    }
+  }
+
+  // merge the files in the order they were given; every declaration is
+  // written where it first appears, which keeps it after the declarations it
+  // depends on (they come before it in the file it first appears in)
+  std::vector<StringRef> SourceFiles;
+  StringSet<> SeenSourceFiles;
+  std::vector<StringRef> Bindings;
+  DenseSet<Binding, BindingInfo> SeenBindings;
+  for (InputFile &Input : Inputs) {
+    for (StringRef SourceFile : Input.SourceFiles) {
+      if (SeenSourceFiles.insert(SourceFile).second)
+        SourceFiles.push_back(SourceFile);
+    }
+    for (const Binding &B : Input.Bindings) {
+      if (SeenBindings.insert(B).second)
+        Bindings.push_back(B.Text);
+    }
+  }
+
+  std::error_code Err;
+  raw_fd_ostream Output(outputFileName, Err, sys::fs::F_None);
+  if (Err) {
+    errs() << "Cannot write to file: " << outputFileName << "\n";
+    return 1;
+  }
+
+  if (sourcesIndex == std::string::npos)
+    Output << header;
+  else {
+    // insert list of source files (each in new line)
+    Output << StringRef(header).substr(0, sourcesIndex);
+    for (StringRef SourceFile : SourceFiles)
+      Output << SourceFile << "\n";
+    Output << StringRef(header).substr(sourcesIndex);
+  }
+
+  Output << "ffi = require(\"ffi\")\nffi.cdef[[";
+  for (StringRef Text : Bindings)
+    Output << "\n\n" << Text;
+  Output << "\n\n]]\n";
+  Output << footer;
+
+  Output.close();
+  if (Output.has_error()) {
+    Output.clear_error();
+    errs() << "Cannot write to file: " << outputFileName << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,591 @@
+//===- FFIGenDriver.cpp ---------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Standalone ffi-gen tool. Generates LuaJIT ffi bindings for translation
+// units listed in a compilation database without compiling them: the files
+// are only parsed, in parallel worker threads. Bindings are written either to
+// one file per translation unit (as the plugin does) or to a single combined
+// file, in which every declaration appears once. Bindings can also be
+// generated from AST files the build has already produced (precompiled
+// headers, -emit-ast output or module files), without parsing anything.
+//
+// Usage: ffi-gen -p <build-path> [options] [<source0> ... <sourceN>]
+//        ffi-gen -ast <file.pch> [-ast <file.ast> ...] [options]
+//
+//===----------------------------------------------------------------------===//
+
+#include "GenerateFFIBindings.hpp"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Signals.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+using namespace clang::tooling;
+
+static llvm::cl::OptionCategory FFIGenCategory("ffi-gen options");
+
+static llvm::cl::opt<std::string>
+    BuildPath("p", llvm::cl::desc("Build path (the directory containing "
+                                  "compile_commands.json)"),
+              llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::list<std::string>
+    SourcePaths(llvm::cl::Positional,
+                llvm::cl::desc("[<source0> ... <sourceN>] (all files in the "
+                               "compilation database by default)"),
+                llvm::cl::ZeroOrMore, llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::list<std::string> ASTFiles(
+    "ast", llvm::cl::desc("AST file (precompiled header, -emit-ast output or "
+                          "module file) to generate bindings from instead of "
+                          "parsing a source file; can be repeated"),
+    llvm::cl::ZeroOrMore, llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> OutputFileName(
+    "output", llvm::cl::desc("Writes bindings of all translation units to "
+                             "this file. Without it, a file is generated for "
+                             "each translation unit."),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> HeaderFileName(
+    "header", llvm::cl::desc("Text file that contains a header to put in the "
+                             "generated files"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> BlacklistFileName(
+    "blacklist", llvm::cl::desc("Text file that contains list of types that "
+                                "should not be emitted or resolved"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> FiltersFileName(
+    "filters", llvm::cl::desc("Text file that contains include and exclude "
+                              "patterns for declarations"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> DestinationDirectory(
+    "destdir", llvm::cl::desc("Directory where output files are generated"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<std::string> CacheDirectory(
+    "cachedir", llvm::cl::desc("Directory where generated files are cached "
+                               "(one file per translation unit only)"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<bool> TestingMode(
+    "test", llvm::cl::desc("Generates bindings for each function, whether "
+                           "it was marked with the ffibinding attribute or "
+                           "not"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<bool> CompactMode(
+    "compact", llvm::cl::desc("Generates bindings that take less time for "
+                              "LuaJIT to parse (one declaration per line)"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<bool> MacrosMode(
+    "macros", llvm::cl::desc("Writes integer constants defined with #define "
+                             "to the bindings"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<bool> ExportAllMode(
+    "export-all", llvm::cl::desc("Generates bindings for every declaration "
+                                 "in the source files, whether it was marked "
+                                 "with the ffibinding attribute or not"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::list<std::string> ExportHeaders(
+    "export-header", llvm::cl::desc("Header whose declarations are exported "
+                                    "too (implies -export-all)"),
+    llvm::cl::cat(FFIGenCategory));
+
+static llvm::cl::opt<unsigned> NumJobs(
+    "j", llvm::cl::desc("Number of worker threads (the number of hardware "
+                        "threads by default)"),
+    llvm::cl::init(0), llvm::cl::cat(FFIGenCategory));
+
+namespace {
+
+char getSeparator() {
+#ifdef LLVM_ON_UNIX
+  return '/';
+#else
+  return '\\';
+#endif
+}
+
+/** Appends a separator to the directory path, if it doesn't end with one. */
+std::string getDirectoryPath(std::string dir) {
+  if (dir.size() > 0 && dir[dir.size() - 1] != getSeparator())
+    dir += getSeparator();
+  return dir;
+}
+
+/**
+ * Declarations generated for all translation units. Every distinct
+ * declaration is stored once, no matter how many translation units it comes
+ * from; each translation unit keeps the list of its declarations in the order
+ * they were printed out. Declarations can be added from multiple threads.
+ **/
+class DeclarationStore {
+public:
+  DeclarationStore(unsigned NumUnits) : Units(NumUnits) {}
+
+  /** Adds the declarations printed out for the translation unit with given
+   * index (the contents of its ffi.cdef block, declarations are separated by
+   * empty lines, or are on a line each in compact mode). */
+  void add(unsigned Unit, StringRef Bindings) {
+
+    SmallVector<StringRef, 64> Blocks;
+    const char *BlockBegin = nullptr;
+    const char *BlockEnd = nullptr;
+    while (!Bindings.empty()) {
+      std::pair<StringRef, StringRef> Split = Bindings.split('\n');
+      if (Split.first.empty()) {
+        if (BlockBegin)
+          Blocks.push_back(StringRef(BlockBegin, BlockEnd - BlockBegin));
+        BlockBegin = nullptr;
+      } else if (CompactMode) {
+        Blocks.push_back(Split.first);
+      } else {
+        if (!BlockBegin)
+          BlockBegin = Split.first.begin();
+        BlockEnd = Split.first.end();
+      }
+      Bindings = Split.second;
+    }
+    if (BlockBegin)
+      Blocks.push_back(StringRef(BlockBegin, BlockEnd - BlockBegin));
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (StringRef Block : Blocks)
+      Units[Unit].push_back(Declarations.insert(Block).first->getKey());
+  }
+
+  /** Prints out declarations of all translation units in order. Each
+   * declaration is printed where it occurs first, which is always after the
+   * declarations it depends on. */
+  void print(llvm::raw_ostream &output) {
+
+    llvm::DenseSet<const char *> Printed;
+    for (std::vector<StringRef> &Unit : Units) {
+      for (StringRef Declaration : Unit) {
+        // declarations are interned, so they can be compared by address
+        if (Printed.insert(Declaration.data()).second)
+          output << Declaration << (CompactMode ? "\n" : "\n\n");
+      }
+    }
+  }
+
+private:
+  std::mutex Mutex;
+  llvm::StringSet<> Declarations;
+  std::vector<std::vector<StringRef>> Units;
+};
+
+/** Returns the options of the consumer, set from the command line. */
+FFIBindingsOptions getConsumerOptions() {
+
+  FFIBindingsOptions options;
+  // plugin arguments with the same effect (part of the cache key)
+  if (TestingMode)
+    options.pluginArguments.push_back("test");
+  if (CompactMode)
+    options.pluginArguments.push_back("-compact");
+  if (MacrosMode)
+    options.pluginArguments.push_back("-macros");
+  if (ExportAllMode)
+    options.pluginArguments.push_back("-export-all");
+  for (const std::string &Header : ExportHeaders) {
+    options.pluginArguments.push_back("-export-header");
+    options.pluginArguments.push_back(Header);
+  }
+  options.pluginArguments.push_back("-header");
+  options.pluginArguments.push_back(HeaderFileName);
+  options.pluginArguments.push_back("-blacklist");
+  options.pluginArguments.push_back(BlacklistFileName);
+  options.pluginArguments.push_back("-filters");
+  options.pluginArguments.push_back(FiltersFileName);
+
+  options.headerFileName = HeaderFileName;
+  options.blacklistFileName = BlacklistFileName;
+  options.filtersFileName = FiltersFileName;
+  options.destinationDirectory = getDirectoryPath(DestinationDirectory);
+  options.cacheDirectory = getDirectoryPath(CacheDirectory);
+  options.isTestingMode = TestingMode;
+  options.isCompactMode = CompactMode;
+  options.isMacrosMode = MacrosMode;
+  options.isExportAllMode = ExportAllMode || !ExportHeaders.empty();
+  options.exportHeaders = ExportHeaders;
+  return options;
+}
+
+/** Names of the files generated for each input file when there is no
+ * -output file, set before the workers are started. */
+std::vector<std::string> OutputFileNames;
+
+/** Returns the name of the file generated for the given input file (e.g.
+ * "test_gen_ffi.lua" for "test.c" or "test.h.pch"). */
+std::string getOutputFileName(StringRef inputFile) {
+
+  StringRef filename = llvm::sys::path::filename(inputFile);
+  while (llvm::sys::path::has_extension(filename) &&
+         llvm::sys::path::stem(filename) != "")
+    filename = llvm::sys::path::stem(filename);
+  return filename.str() + "_gen_ffi.lua";
+}
+
+/**
+ * Sets the names of the files generated for the input files from their paths
+ * relative to the directory that contains all of them, so that files with
+ * the same name in different directories don't overwrite each other's
+ * output (e.g. "foo_a_gen_ffi.lua" and "bar_a_gen_ffi.lua" for "foo/a.c" and
+ * "bar/a.c"). Returns false if two input files would still generate the same
+ * file (e.g. "a.c" and "a.cpp").
+ **/
+bool setOutputFileNames(const std::vector<std::string> &Files) {
+
+  std::string Root;
+  if (!Files.empty())
+    Root = llvm::sys::path::parent_path(Files[0]);
+  for (const std::string &File : Files) {
+    while (Root != "" && !StringRef(File).startswith(getDirectoryPath(Root)))
+      Root = llvm::sys::path::parent_path(Root);
+  }
+
+  llvm::StringMap<StringRef> InputFiles;
+  OutputFileNames.clear();
+  for (const std::string &File : Files) {
+    StringRef Relative = StringRef(File).substr(getDirectoryPath(Root).size());
+    std::string Prefix = llvm::sys::path::parent_path(Relative);
+    std::replace(Prefix.begin(), Prefix.end(), getSeparator(), '_');
+    std::string Name =
+        (Prefix != "" ? Prefix + "_" : "") + getOutputFileName(File);
+
+    std::pair<llvm::StringMap<StringRef>::iterator, bool> Inserted =
+        InputFiles.insert(std::make_pair(Name, StringRef(File)));
+    if (!Inserted.second) {
+      llvm::errs() << "Error: \"" << Inserted.first->second << "\" and \""
+                   << File << "\" would both generate \"" << Name << "\"!\n";
+      return false;
+    }
+    OutputFileNames.push_back(Name);
+  }
+  return true;
+}
+
+/**
+ * Runs the ffi-gen consumer on one translation unit, with options set from
+ * the command line.
+ **/
+class GenerateFFIBindingsToolAction : public ASTFrontendAction {
+public:
+  GenerateFFIBindingsToolAction(DeclarationStore *Store_, unsigned Unit_)
+      : Store(Store_), Unit(Unit_) {}
+
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 llvm::StringRef inputFile) {
+
+    FFIBindingsOptions options = getConsumerOptions();
+
+    std::unique_ptr<GenerateFFIBindingsConsumer> Consumer;
+    if (Store)
+      Consumer = llvm::make_unique<GenerateFFIBindingsConsumer>(
+          options, CI.getPreprocessor().getPredefines(), &Bindings);
+    else {
+      options.outputFileName = OutputFileNames[Unit];
+      Consumer = llvm::make_unique<GenerateFFIBindingsConsumer>(
+          options, CI.getPreprocessor().getPredefines());
+    }
+
+    if (options.isMacrosMode) {
+      std::unique_ptr<MacroConstantCollector> MacroConstants =
+          llvm::make_unique<MacroConstantCollector>(CI.getPreprocessor());
+      Consumer->setMacroConstants(MacroConstants.get());
+      CI.getPreprocessor().addPPCallbacks(std::move(MacroConstants));
+    }
+    return std::move(Consumer);
+  }
+
+  void EndSourceFileAction() {
+    if (Store)
+      Store->add(Unit, Bindings.str());
+  }
+
+private:
+  DeclarationStore *Store;
+  unsigned Unit;
+  std::string BindingsBuffer;
+  llvm::raw_string_ostream Bindings{BindingsBuffer};
+};
+
+class GenerateFFIBindingsToolActionFactory : public FrontendActionFactory {
+public:
+  GenerateFFIBindingsToolActionFactory(DeclarationStore *Store_,
+                                       unsigned Unit_)
+      : Store(Store_), Unit(Unit_) {}
+
+  clang::FrontendAction *create() {
+    return new GenerateFFIBindingsToolAction(Store, Unit);
+  }
+
+private:
+  DeclarationStore *Store;
+  unsigned Unit;
+};
+
+/** Generates bindings from an AST file, which is deserialized as the
+ * consumer traverses it. Returns false if the file can't be loaded. */
+bool generateFromASTFile(const std::string &ASTFile, DeclarationStore *Store,
+                         unsigned Unit) {
+
+  IntrusiveRefCntPtr<DiagnosticsEngine> Diags =
+      CompilerInstance::createDiagnostics(new DiagnosticOptions());
+  std::unique_ptr<ASTUnit> AST = ASTUnit::LoadFromASTFile(
+      ASTFile, RawPCHContainerReader(), Diags, FileSystemOptions());
+  if (!AST) {
+    llvm::errs() << "Error loading AST file \"" << ASTFile << "\"!\n";
+    return false;
+  }
+
+  FFIBindingsOptions options = getConsumerOptions();
+  std::string BindingsBuffer;
+  llvm::raw_string_ostream Bindings(BindingsBuffer);
+  std::unique_ptr<GenerateFFIBindingsConsumer> Consumer;
+  if (Store)
+    Consumer = llvm::make_unique<GenerateFFIBindingsConsumer>(
+        options, AST->getPreprocessor().getPredefines(), &Bindings);
+  else {
+    options.outputFileName = OutputFileNames[Unit];
+    Consumer = llvm::make_unique<GenerateFFIBindingsConsumer>(
+        options, AST->getPreprocessor().getPredefines());
+  }
+
+  // the macros of an AST file have already been defined
+  std::unique_ptr<MacroConstantCollector> MacroConstants;
+  if (options.isMacrosMode) {
+    MacroConstants =
+        llvm::make_unique<MacroConstantCollector>(AST->getPreprocessor());
+    MacroConstants->collectDefinedMacros();
+    Consumer->setMacroConstants(MacroConstants.get());
+  }
+
+  Consumer->HandleTranslationUnit(AST->getASTContext());
+  if (Store)
+    Store->add(Unit, Bindings.str());
+  return true;
+}
+
+/** Parses a source file with each of its compile commands and generates
+ * bindings from it. ClangTool is not used, because it changes the working
+ * directory of the process to the directory of the compile command, and
+ * files are parsed in multiple threads; relative paths are resolved against
+ * the directory of the compile command by the file manager (and the driver,
+ * with -working-directory) instead. Returns false if parsing fails. */
+bool parseSourceFile(const CompilationDatabase &Compilations,
+                     const std::string &File,
+                     const std::string &MainExecutable,
+                     DeclarationStore *Store, unsigned Unit) {
+
+  std::vector<CompileCommand> Commands = Compilations.getCompileCommands(File);
+  if (Commands.empty()) {
+    llvm::errs() << "Skipping " << File
+                 << ". Compile command not found.\n";
+    return false;
+  }
+
+  bool Success = true;
+  for (CompileCommand &Command : Commands) {
+    std::vector<std::string> CommandLine = getClangStripOutputAdjuster()(
+        getClangSyntaxOnlyAdjuster()(Command.CommandLine));
+    CommandLine[0] = MainExecutable;
+    CommandLine.insert(CommandLine.begin() + 1, "-working-directory");
+    CommandLine.insert(CommandLine.begin() + 2, Command.Directory);
+
+    FileSystemOptions FileSystemOpts;
+    FileSystemOpts.WorkingDir = Command.Directory;
+    IntrusiveRefCntPtr<FileManager> Files(new FileManager(FileSystemOpts));
+    GenerateFFIBindingsToolActionFactory Factory(Store, Unit);
+    ToolInvocation Invocation(std::move(CommandLine), &Factory, Files.get());
+    if (!Invocation.run()) {
+      llvm::errs() << "Error while processing " << File << ".\n";
+      Success = false;
+    }
+  }
+  return Success;
+}
+
+/** Returns the path made absolute against the current directory, which
+ * mustn't change once worker threads are started; "" stays "". */
+std::string getAbsolutePath(StringRef Path) {
+
+  if (Path.empty())
+    return "";
+  SmallString<256> AbsolutePath(Path);
+  llvm::sys::fs::make_absolute(AbsolutePath);
+  return AbsolutePath.str();
+}
+
+/** Writes the combined output file. Returns false if it can't be written. */
+bool writeCombinedOutput(DeclarationStore &Store,
+                         const std::vector<std::string> &Files) {
+
+  std::error_code Err;
+  std::string outputFileName =
+      getDirectoryPath(DestinationDirectory) + OutputFileName;
+  OutputSink output(outputFileName);
+  if (!output.open(Err)) {
+    llvm::errs() << "Error creating file \"" << outputFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+
+  if (HeaderFileName != "") {
+    std::string line;
+    std::ifstream headerFile(HeaderFileName);
+    if (!headerFile.is_open()) {
+      llvm::outs() << "Error opening file: \"" << HeaderFileName << "\"\n";
+      return false;
+    }
+    while (getline(headerFile, line)) {
+      // the place holder is replaced by the list of all source files (each
+      // in new line)
+      if (line.find(constants::SRC_FILE_PLACE_HOLDER) != std::string::npos) {
+        std::string prefix =
+            line.substr(0, line.find(constants::SRC_FILE_PLACE_HOLDER));
+        std::string suffix =
+            line.substr(line.find(constants::SRC_FILE_PLACE_HOLDER) +
+                        constants::SRC_FILE_PLACE_HOLDER.length());
+        for (const std::string &File : Files)
+          output.stream() << prefix << ">> " << File << suffix << "\n";
+        continue;
+      }
+      output.stream() << line << "\n";
+    }
+    headerFile.close();
+  }
+
+  output.stream() << "ffi = require(\"ffi\")\nffi.cdef[[\n";
+  if (!CompactMode)
+    output.stream() << "\n";
+  Store.print(output.stream());
+  output.stream() << "]]\n";
+
+  if (!output.commit(Err)) {
+    llvm::errs() << "Error writing file \"" << outputFileName
+                 << "\" : " << Err.message() << "!\n";
+    return false;
+  }
+  return true;
+}
+}
+
+int main(int argc, const char **argv) {
+
+  llvm::sys::PrintStackTraceOnErrorSignal();
+  llvm::cl::HideUnrelatedOptions(FFIGenCategory);
+  llvm::cl::ParseCommandLineOptions(
+      argc, argv, "ffi-gen: generates LuaJIT ffi bindings for translation "
+                  "units in a compilation database\n");
+
+  // a compilation database is only needed to parse source files
+  std::string ErrorMessage;
+  std::unique_ptr<CompilationDatabase> Compilations;
+  if (BuildPath != "")
+    Compilations =
+        CompilationDatabase::autoDetectFromDirectory(BuildPath, ErrorMessage);
+  else if (SourcePaths.size() > 0)
+    Compilations =
+        CompilationDatabase::autoDetectFromSource(SourcePaths[0], ErrorMessage);
+  if (!Compilations && (ASTFiles.empty() || SourcePaths.size() > 0)) {
+    llvm::errs() << "Error while trying to load a compilation database:\n"
+                 << ErrorMessage << "\n";
+    return 1;
+  }
+
+  // translation units are processed (and their bindings combined) in the
+  // order they are listed in, or sorted by path when they are all taken
+  // from the compilation database, so that the output doesn't depend on
+  // which worker finishes first
+  std::vector<std::string> Files(SourcePaths.begin(), SourcePaths.end());
+  if (Files.empty() && Compilations) {
+    Files = Compilations->getAllFiles();
+    std::sort(Files.begin(), Files.end());
+  }
+  // AST files come after the source files
+  unsigned NumSourceFiles = Files.size();
+  Files.insert(Files.end(), ASTFiles.begin(), ASTFiles.end());
+  for (std::string &File : Files)
+    File = getAbsolutePath(File);
+
+  // all paths given on the command line are relative to the directory ffi-gen
+  // was started in, whichever translation unit they are used for
+  DestinationDirectory =
+      getAbsolutePath(DestinationDirectory != "" ? DestinationDirectory : ".");
+  CacheDirectory = getAbsolutePath(CacheDirectory);
+  HeaderFileName = getAbsolutePath(HeaderFileName);
+  BlacklistFileName = getAbsolutePath(BlacklistFileName);
+  FiltersFileName = getAbsolutePath(FiltersFileName);
+  for (std::string &Header : ExportHeaders)
+    Header = getAbsolutePath(Header);
+  static int StaticSymbol;
+  std::string MainExecutable =
+      llvm::sys::fs::getMainExecutable(argv[0], &StaticSymbol);
+
+  std::unique_ptr<DeclarationStore> Store;
+  if (OutputFileName != "")
+    Store = llvm::make_unique<DeclarationStore>(Files.size());
+  else if (!setOutputFileNames(Files))
+    return 1;
+
+  unsigned Jobs = NumJobs ? NumJobs : std::thread::hardware_concurrency();
+  if (Jobs == 0)
+    Jobs = 1;
+  if (Jobs > Files.size())
+    Jobs = Files.size();
+
+  // every worker takes the next translation unit that hasn't been taken yet
+  std::atomic<unsigned> NextFile(0);
+  std::atomic<bool> Failed(false);
+  auto Worker = [&]() {
+    for (unsigned i = NextFile++; i < Files.size(); i = NextFile++) {
+      if (i >= NumSourceFiles) {
+        if (!generateFromASTFile(Files[i], Store.get(), i))
+          Failed = true;
+        continue;
+      }
+      if (!parseSourceFile(*Compilations, Files[i], MainExecutable,
+                           Store.get(), i))
+        Failed = true;
+    }
+  };
+
+  std::vector<std::thread> Threads;
+  for (unsigned i = 1; i < Jobs; i++)
+    Threads.push_back(std::thread(Worker));
+  Worker();
+  for (std::thread &Thread : Threads)
+    Thread.join();
+
+  if (Store && !writeCombinedOutput(*Store, Files))
+    return 1;
+  return Failed ? 1 : 0;
+}